@@ -0,0 +1,148 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <Eigen/Eigen>
+
+#include <g2o/types/slam3d/se3quat.h>
+
+#include "ProbDist.hpp"
+#include "VoteAccum.hpp"
+#include "Types.hpp"
+
+using namespace std;
+
+// synthetic set of valid transformations - a few clusters around true poses and uniform outliers
+static void genTransforms(std::default_random_engine &gen,
+                          int numClusters,
+                          int numPerCluster,
+                          int numOutliers,
+                          vectorVector7d &transforms,
+                          vector<double> &scores)
+{
+    uniform_real_distribution<double> transDistr(-5.0, 5.0);
+    uniform_real_distribution<double> rotDistr(-M_PI, M_PI);
+    normal_distribution<double> noiseDistr(0.0, 0.03);
+    uniform_real_distribution<double> scoreDistr(0.1, 1.0);
+    
+    auto randPose = [&](){
+        Vector6d logMap;
+        logMap << rotDistr(gen) / 2.0, rotDistr(gen) / 2.0, rotDistr(gen) / 2.0,
+                transDistr(gen), transDistr(gen), transDistr(gen);
+        return g2o::SE3Quat::exp(logMap);
+    };
+    
+    for(int c = 0; c < numClusters; ++c){
+        g2o::SE3Quat center = randPose();
+        // the first cluster is the strongest one
+        int curNum = numPerCluster / (c + 1);
+        for(int t = 0; t < curNum; ++t){
+            Vector6d noise;
+            for(int i = 0; i < 6; ++i){
+                noise(i) = noiseDistr(gen);
+            }
+            transforms.push_back((center * g2o::SE3Quat::exp(noise)).toVector());
+            scores.push_back(scoreDistr(gen));
+        }
+    }
+    for(int t = 0; t < numOutliers; ++t){
+        transforms.push_back(randPose().toVector());
+        scores.push_back(scoreDistr(gen));
+    }
+}
+
+int main(int argc, char * argv[]){
+    int numTrials = 20;
+    vector<int> numOutliersSet{100, 1000, 10000};
+    
+    // the same as in Matching::searchShards
+    Eigen::Matrix<double, 6, 6> distInfMat = 10.0 * Eigen::Matrix<double, 6, 6>::Identity();
+    double kernelMaxExp = 20.0;
+    double voteTransCellSize = 0.2;
+    double voteRotCellSize = 0.2;
+    int voteNumPeaks = 16;
+    
+    std::default_random_engine gen(1234);
+    
+    for(int numOutliers : numOutliersSet){
+        double kernelTime = 0.0;
+        double voteTime = 0.0;
+        int numAgree = 0;
+        int numTrans = 0;
+        for(int tr = 0; tr < numTrials; ++tr){
+            vectorVector7d transforms;
+            vector<double> scores;
+            genTransforms(gen, 3, 100, numOutliers, transforms, scores);
+            numTrans = transforms.size();
+            
+            chrono::high_resolution_clock::time_point startKernelTime = chrono::high_resolution_clock::now();
+            
+            ProbDist dist(distInfMat, kernelMaxExp);
+            for(int t = 0; t < transforms.size(); ++t){
+                dist.addKernel(transforms[t], scores[t]);
+            }
+            int bestKernel = 0;
+            double bestKernelVal = 0.0;
+            for(int t = 0; t < transforms.size(); ++t){
+                double curVal = dist.eval(transforms[t]);
+                if(curVal > bestKernelVal){
+                    bestKernelVal = curVal;
+                    bestKernel = t;
+                }
+            }
+            
+            chrono::high_resolution_clock::time_point startVoteTime = chrono::high_resolution_clock::now();
+            
+            VoteAccum accum(voteTransCellSize, voteRotCellSize);
+            for(int t = 0; t < transforms.size(); ++t){
+                accum.addVote(transforms[t], scores[t], t);
+            }
+            vector<pair<double, int>> peaks = accum.getPeaks(voteNumPeaks, true);
+            int bestVote = peaks.front().second;
+            
+            chrono::high_resolution_clock::time_point endTime = chrono::high_resolution_clock::now();
+            
+            kernelTime += chrono::duration_cast<chrono::microseconds>(startVoteTime - startKernelTime).count();
+            voteTime += chrono::duration_cast<chrono::microseconds>(endTime - startVoteTime).count();
+            
+            // the same criterion as for distinct maxima in Matching::searchShards
+            Vector6d diffLog = (g2o::SE3Quat(transforms[bestKernel]).inverse() *
+                                g2o::SE3Quat(transforms[bestVote])).log();
+            if(diffLog.transpose() * diffLog < 0.11){
+                ++numAgree;
+            }
+        }
+        
+        cout << "transforms = " << numTrans << endl;
+        cout << "kernels mean time = " << kernelTime / numTrials << " us" << endl;
+        cout << "voting mean time = " << voteTime / numTrials << " us" << endl;
+        cout << "peak agreement = " << numAgree << "/" << numTrials << endl;
+    }
+    
+    return 0;
+}
@@ -10,11 +10,15 @@
 class ConcaveHull;
 
 #include <vector>
+#include <memory>
+#include <cstdint>
 
 #include <boost/serialization/vector.hpp>
 
 #include <Eigen/Eigen>
 
+#include <opencv2/opencv.hpp>
+
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/impl/point_types.hpp>
 #include <pcl/point_cloud.h>
@@ -57,6 +61,32 @@ public:
     typedef Alpha_shape_2::Alpha_shape_edges_iterator            Alpha_shape_edges_iterator;
     typedef Alpha_shape_2::Alpha_shape_vertices_iterator         Alpha_shape_vertices_iterator;
     
+    enum class IntersectMode{
+        // CGAL exact kernel, reference results
+        Exact,
+        // double precision clipping of fan triangles
+        Inexact,
+        // counting common cells of bit-packed occupancy rasters
+        Raster
+    };
+    
+    struct IntersectParams{
+        IntersectParams(IntersectMode imode = IntersectMode::Exact,
+                        double irasterCellSize = 0.02)
+                : mode(imode),
+                  rasterCellSize(irasterCellSize)
+        {}
+        
+        IntersectMode mode;
+        // used only in the raster mode
+        double rasterCellSize;
+    };
+    
+    /**
+     * Reads hullIntersectMode ("exact", "inexact" or "raster") and hullRasterCellSize.
+     */
+    static IntersectParams readIntersectParams(const cv::FileNode &node);
+    
     ConcaveHull();
     
     ConcaveHull(pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr ipoints3d,
@@ -101,6 +131,21 @@ public:
     ConcaveHull intersect(const std::vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> &otherPolygons3d,
                           double areaThresh = 0.05) const;
     
+    /**
+     * Area of intersection with the other hull projected onto plane of this hull.
+     */
+    double intersectArea(const ConcaveHull &other,
+                         const IntersectParams &params) const;
+    
+    /**
+     * Area of intersection with the other hull transformed by otherTransform.
+     * Only the exact mode builds the transformed hull, the inexact one transforms
+     * points of its polygons and the raster one resamples its raster.
+     */
+    double intersectArea(const ConcaveHull &other,
+                         const Vector7d &otherTransform,
+                         const IntersectParams &params) const;
+    
     ConcaveHull clipToCameraFrustum(const cv::Mat K,
                                     int rows,
                                     int cols,
@@ -110,6 +155,12 @@ public:
     
     double minDistance(const ConcaveHull &other) const;
     
+    /**
+     * Computes and caches exact coordinates of polygon vertices, so that the hull
+     * can be later read by many threads without lazy evaluation.
+     */
+    void computeExact() const;
+    
     void display(pcl::visualization::PCLVisualizer::Ptr viewer,
                  int vp,
                  double r = 0.0,
@@ -121,6 +172,17 @@ public:
     
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 private:
+    // occupancy of cells in the plane frame
+    struct Raster{
+        // rows of 64-bit words
+        std::vector<uint64_t> cells;
+        double cellSize;
+        Eigen::Vector2d origin;
+        int rows, cols, rowWords;
+        
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    
     void computeFrame();
     
     Point_2 point3dTo2d(const Eigen::Vector3d &point3d) const;
@@ -129,7 +191,28 @@ private:
     
     Eigen::Vector3d point2dTo3d(const Point_2 &point2d) const;
     
+    void computeInexact();
+    
+    std::shared_ptr<const Raster> computeRaster(double cellSize) const;
+    
+    /**
+     * Raster with cells of cellSize, computed on first use. Safe to call from many threads,
+     * concurrent first calls may compute it more than once.
+     */
+    std::shared_ptr<const Raster> getRaster(double cellSize) const;
+    
+    double intersectAreaInexact(const ConcaveHull &other,
+                                const Eigen::Matrix4d &otherTransformMat) const;
+    
+    double intersectAreaRaster(const ConcaveHull &other,
+                               const Eigen::Matrix4d &otherTransformMat,
+                               double rasterCellSize) const;
+    
     std::vector<Polygon_2> polygons;
+    // polygons converted to doubles for the inexact intersection
+    std::vector<Polygon_2ie> polygonsie;
+    // accessed atomically, null until the first use in the raster mode
+    mutable std::shared_ptr<const Raster> raster;
     std::vector<double> areas;
     double totalArea;
     std::vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> polygons3d;
@@ -154,6 +237,11 @@ private:
         ar & origin;
         ar & xAxis;
         ar & yAxis;
+        
+        if(Archive::is_loading::value){
+            computeInexact();
+            raster.reset();
+        }
     }
 };
 
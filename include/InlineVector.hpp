@@ -0,0 +1,126 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_INLINEVECTOR_HPP_
+#define INCLUDE_INLINEVECTOR_HPP_
+
+#include <array>
+#include <vector>
+#include <initializer_list>
+
+/**
+ * Vector of at most N elements stored in place, so containers of objects holding it
+ * do not allocate per element.
+ */
+template<class T, int N>
+class InlineVector {
+public:
+    InlineVector()
+        : n(0)
+    {}
+    
+    explicit InlineVector(const std::vector<T> &vec)
+        : n(0)
+    {
+        for(const T &val : vec){
+            push_back(val);
+        }
+    }
+    
+    InlineVector(std::initializer_list<T> vals)
+        : n(0)
+    {
+        for(const T &val : vals){
+            push_back(val);
+        }
+    }
+    
+    static constexpr int capacity() {
+        return N;
+    }
+    
+    inline int size() const {
+        return n;
+    }
+    
+    inline bool empty() const {
+        return n == 0;
+    }
+    
+    inline bool full() const {
+        return n == N;
+    }
+    
+    // caller has to check that the vector is not full
+    inline void push_back(const T &val) {
+        data[n++] = val;
+    }
+    
+    inline void pop_back() {
+        --n;
+    }
+    
+    inline T &back() {
+        return data[n - 1];
+    }
+    
+    inline const T &back() const {
+        return data[n - 1];
+    }
+    
+    inline void clear() {
+        n = 0;
+    }
+    
+    inline T &operator[](int i) {
+        return data[i];
+    }
+    
+    inline const T &operator[](int i) const {
+        return data[i];
+    }
+    
+    inline T *begin() {
+        return data.data();
+    }
+    
+    inline T *end() {
+        return data.data() + n;
+    }
+    
+    inline const T *begin() const {
+        return data.data();
+    }
+    
+    inline const T *end() const {
+        return data.data() + n;
+    }
+    
+private:
+    std::array<T, N> data;
+    
+    int n;
+};
+
+
+#endif /* INCLUDE_INLINEVECTOR_HPP_ */
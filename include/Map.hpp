@@ -35,8 +35,12 @@ class Map;
 #include <boost/serialization/split_member.hpp>
 #include <boost/serialization/list.hpp>
 #include <boost/serialization/set.hpp>
+#include <boost/serialization/version.hpp>
 
 #include "ObjInstance.hpp"
+#include "MapIndex.hpp"
+#include "ObjGrid.hpp"
+#include "ZBuffer.hpp"
 #include "Serialization.hpp"
 
 struct PendingMatch {
@@ -106,16 +110,37 @@ public:
         }
     };
     
+    /**
+     * Parameters of merging objects, not serialized.
+     */
+    struct MergeParams{
+        MergeParams()
+                : gridCellSize(1.0),
+                  gridMargin(0.1)
+        {}
+        
+        ConcaveHull::IntersectParams hullIntersect;
+        // cell size and query margin of the grid of merge candidates
+        double gridCellSize;
+        double gridMargin;
+    };
+    
 	Map();
 	
+    explicit Map(const MergeParams &imergeParams);
+    
 	Map(const cv::FileStorage& fs);
+    
+    static MergeParams readMergeParams(const cv::FileStorage &fs);
 
 	void addObj(ObjInstance& obj);
     
     void addObjs(vectorObjInstance::iterator beg,
                  vectorObjInstance::iterator end);
     
-    inline listObjInstance::iterator removeObj(listObjInstance::iterator it){
+    inline listObjInstance::iterator removeObj(listObjInstance::const_iterator it){
+        index = MapIndex();
+        grid.remove(it->getId());
 		return objInstances.erase(it);
 	}
 
@@ -127,11 +152,15 @@ public:
 //		return objInstances[i];
 //	}
     
-    inline listObjInstance::iterator begin(){
+    /**
+     * Objects are read-only through iterators, as changing them would leave
+     * the grid of merge candidates and the index stale.
+     */
+    inline listObjInstance::const_iterator begin() const {
         return objInstances.begin();
     }
     
-    inline listObjInstance::iterator end(){
+    inline listObjInstance::const_iterator end() const {
         return objInstances.end();
     }
     
@@ -190,12 +219,51 @@ public:
     inline pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr getOriginalPointCloud(){
         return originalPointCloud;
     }
+    
+    /**
+     * Builds geometric index of object instances in the order of iteration.
+     * The index is cleared when object instances change.
+     */
+    void buildIndex(double maxDist,
+                    double angBinSize,
+                    double distBinSize,
+                    ThreadPool &threadPool);
+    
+    /**
+     * Builds parts of a loaded index that are not serialized - kd-tree, histograms and descriptors.
+     * They are not built when the map is loaded, as maps read from files are usually merged
+     * and reindexed, so this has to be called before a loaded index is used for matching.
+     */
+    void buildIndexCaches();
+    
+    inline const MapIndex &getIndex() const {
+        return index;
+    }
+    
+    /**
+     * Reads every map file as a separate shard, without merging objects of different files.
+     * Ids are shifted in the same way as when files are merged into a single map.
+     */
+    static std::vector<vectorObjInstance> readShards(const cv::FileStorage &fs);
+    
+    /**
+     * Objects of every map file if map/shardMapFiles was set when reading the map, empty otherwise.
+     * The map contains the same objects, but neither merged nor indexed.
+     */
+    inline const std::vector<vectorObjInstance> &getShards() const {
+        return shards;
+    }
 private:
+    // ids of objects from consecutive map files start at multiples of fileIdShift
+    static constexpr int fileIdShift = 10000000;
+    
     pcl::PointCloud<pcl::PointXYZL>::Ptr getLabeledPointCloud();
 
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr getColorPointCloud();
 
     void recalculateIdToIter();
+    
+    void rebuildGrid();
 
 	listObjInstance objInstances;
     
@@ -212,6 +280,19 @@ private:
     
     Settings settings;
     
+    MergeParams mergeParams;
+    
+    MapIndex index;
+    
+    // merge candidates, not serialized
+    ObjGrid grid;
+    
+    // objects of map files read as separate shards, not serialized
+    std::vector<vectorObjInstance> shards;
+    
+    // reused by getVisibleObjs
+    ZBuffer zBuffer;
+    
     friend class boost::serialization::access;
     
     template<class Archive>
@@ -221,6 +302,7 @@ private:
         ar << pendingMatchesSet;
         ar << originalPointCloud;
         ar << settings;
+        ar << index;
     }
     
     template<class Archive>
@@ -230,8 +312,13 @@ private:
         ar >> pendingMatchesSet;
         ar >> originalPointCloud;
         ar >> settings;
+        if(version > 0){
+            // caches of the index are built on demand, see buildIndexCaches
+            ar >> index;
+        }
         
         recalculateIdToIter();
+        rebuildGrid();
     }
     
     template<class Archive>
@@ -241,6 +328,7 @@ private:
     }
 };
 
+BOOST_CLASS_VERSION(Map, 1)
 
 
 #endif /* INCLUDE_MAP_HPP_ */
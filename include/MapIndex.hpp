@@ -0,0 +1,314 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_MAPINDEX_HPP_
+#define INCLUDE_MAPINDEX_HPP_
+
+#include <vector>
+#include <utility>
+#include <memory>
+
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/version.hpp>
+
+#include <pcl/point_cloud.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include <flann/flann.hpp>
+
+#include "Types.hpp"
+#include "ObjInstance.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * Geometric index of a static set of object instances. Stores pairwise angles between
+ * normals and hull distances for all pairs that are not farther than maxDist, and
+ * a hash of pair signatures (angle, distance), so pairs consistent with
+ * a pair observed in a frame can be looked up instead of scanned.
+ * Objects are referred to by their position in the vector the index was built from.
+ * Points of all objects are kept in a kd-tree for nearest neighbor queries
+ * and their color histograms in a matrix for computing appearance distances.
+ * Descriptors of objects are indexed by their coarse histograms, so candidates
+ * for a frame object are looked up instead of comparing it with every object.
+ */
+class MapIndex {
+public:
+    struct Neighbor {
+        int idx;
+
+        double dist;
+
+        double ang;
+
+        template<class Archive>
+        void serialize(Archive & ar, const unsigned int version)
+        {
+            ar & idx;
+            ar & dist;
+            ar & ang;
+        }
+    };
+
+    MapIndex();
+
+    MapIndex(const vectorObjInstance &objInstances,
+             double maxDist,
+             double angBinSize,
+             double distBinSize,
+             ThreadPool &threadPool);
+
+    void build(const vectorObjInstance &objInstances,
+               double maxDist,
+               double angBinSize,
+               double distBinSize,
+               ThreadPool &threadPool);
+
+    inline bool isBuilt() const {
+        return built;
+    }
+
+    inline int size() const {
+        return ids.size();
+    }
+
+    inline double getMaxDist() const {
+        return maxDist;
+    }
+
+    inline const std::vector<int> &getIds() const {
+        return ids;
+    }
+
+    /**
+     * Checks if the index was built from the same objects in the same order.
+     */
+    bool isValidFor(const vectorObjInstance &objInstances) const;
+
+    /**
+     * Neighbors not farther than maxDist, sorted by index.
+     */
+    inline const std::vector<Neighbor> &getNeighbors(int idx) const {
+        return neighbors[idx];
+    }
+
+    /**
+     * Returns nullptr if objects are farther than maxDist.
+     */
+    const Neighbor *findNeighbor(int idx1, int idx2) const;
+
+    /**
+     * Pairs (idx1 < idx2) with angle between normals in [ang - angThresh, ang + angThresh]
+     * and distance not larger than distThresh.
+     */
+    void findPairs(double ang,
+                   double angThresh,
+                   double distThresh,
+                   std::vector<std::pair<int, int>> &pairs) const;
+
+    /**
+     * Upper bound on the number of pairs returned by findPairs, without distance filtering.
+     */
+    size_t countPairs(double ang,
+                      double angThresh) const;
+
+    static double compNormalAngle(const ObjInstance &obj1,
+                                  const ObjInstance &obj2);
+
+    /**
+     * Builds parts of the index that are not serialized - kd-tree, histograms and descriptors.
+     * Objects have to be the ones the index was built from.
+     */
+    template<class Iterator>
+    void buildCaches(Iterator beg, Iterator end);
+
+    /**
+     * Builds kd-tree of points of objects, that have to be the ones the index was built from.
+     * Used after deserialization, because the tree is not stored.
+     */
+    template<class Iterator>
+    void buildKdTree(Iterator beg, Iterator end);
+
+    inline bool hasKdTree() const {
+        return kdTree != nullptr;
+    }
+
+    /**
+     * Points of all objects in the order of objects.
+     */
+    inline pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr getPoints() const {
+        return points;
+    }
+
+    inline const pcl::KdTreeFLANN<pcl::PointXYZRGB> &getKdTree() const {
+        return *kdTree;
+    }
+
+    /**
+     * Builds color histograms of objects, that have to be the ones the index was built from.
+     * Used after deserialization, because histograms are not stored.
+     */
+    template<class Iterator>
+    void buildHists(Iterator beg, Iterator end);
+
+    inline bool hasHists() const {
+        return hists.rows() == ids.size();
+    }
+
+    /**
+     * Color histograms of objects in the order of objects.
+     */
+    inline const ObjInstance::HistMatrix &getHists() const {
+        return hists;
+    }
+
+    template<class Iterator>
+    void buildDescriptors(Iterator beg, Iterator end);
+
+    inline bool hasDescriptors() const {
+        return descs.size() == ids.size() && (descs.empty() || descIndex);
+    }
+
+    inline const vectorObjDescriptor &getDescriptors() const {
+        return descs;
+    }
+
+    /**
+     * Indices of objects with descriptors compatible with desc according to
+     * ObjInstance::checkDescriptors, sorted.
+     */
+    void findCandidates(const ObjInstance::Descriptor &desc,
+                        const ObjInstance::DescriptorThresh &thresh,
+                        std::vector<int> &candidates) const;
+
+private:
+    int getAngBin(double ang) const;
+
+    int getDistBin(double dist) const;
+
+    bool built;
+
+    std::vector<int> ids;
+
+    double maxDist;
+
+    double angBinSize;
+
+    double distBinSize;
+
+    int numAngBins;
+
+    int numDistBins;
+
+    std::vector<std::vector<Neighbor>> neighbors;
+
+    // pairs (idx1 < idx2) for every angle bin and distance bin
+    std::vector<std::vector<std::pair<int, int>>> pairBuckets;
+
+    // not serialized
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr points;
+
+    pcl::KdTreeFLANN<pcl::PointXYZRGB>::Ptr kdTree;
+
+    ObjInstance::HistMatrix hists;
+
+    typedef Eigen::Matrix<float, Eigen::Dynamic, ObjInstance::coarseHistBins, Eigen::RowMajor> CoarseHistMatrix;
+
+    vectorObjDescriptor descs;
+
+    // rows are referenced by descIndex, so both are shared between copies
+    std::shared_ptr<CoarseHistMatrix> coarseHists;
+
+    std::shared_ptr<flann::Index<flann::L1<float>>> descIndex;
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+        ar & built;
+        ar & ids;
+        ar & maxDist;
+        ar & angBinSize;
+        ar & distBinSize;
+        ar & numAngBins;
+        ar & numDistBins;
+        ar & neighbors;
+        ar & pairBuckets;
+        // distances stored before version 1 were not minimal, such an index has to be rebuilt
+        if(Archive::is_loading::value && version < 1){
+            built = false;
+        }
+    }
+};
+
+BOOST_CLASS_VERSION(MapIndex, 1)
+
+template<class Iterator>
+void MapIndex::buildCaches(Iterator beg, Iterator end) {
+    buildKdTree(beg, end);
+    buildHists(beg, end);
+    buildDescriptors(beg, end);
+}
+
+template<class Iterator>
+void MapIndex::buildKdTree(Iterator beg, Iterator end) {
+    points.reset(new pcl::PointCloud<pcl::PointXYZRGB>());
+    for(Iterator it = beg; it != end; ++it){
+        points->insert(points->end(), it->getPoints()->begin(), it->getPoints()->end());
+    }
+    kdTree.reset();
+    // FLANN does not accept empty clouds
+    if(!points->empty()){
+        kdTree.reset(new pcl::KdTreeFLANN<pcl::PointXYZRGB>());
+        kdTree->setInputCloud(points);
+    }
+}
+
+template<class Iterator>
+void MapIndex::buildHists(Iterator beg, Iterator end) {
+    ObjInstance::compHistMatrix(beg, end, hists);
+}
+
+template<class Iterator>
+void MapIndex::buildDescriptors(Iterator beg, Iterator end) {
+    descs.clear();
+    for(Iterator it = beg; it != end; ++it){
+        descs.push_back(it->compDescriptor());
+    }
+    coarseHists.reset(new CoarseHistMatrix(descs.size(), (int)ObjInstance::coarseHistBins));
+    for(int d = 0; d < descs.size(); ++d){
+        coarseHists->row(d) = descs[d].coarseHist.transpose();
+    }
+    descIndex.reset();
+    // FLANN does not accept empty data
+    if(!descs.empty()){
+        flann::Matrix<float> data(coarseHists->data(), coarseHists->rows(), coarseHists->cols());
+        descIndex.reset(new flann::Index<flann::L1<float>>(data, flann::KDTreeSingleIndexParams(10)));
+        descIndex->buildIndex();
+    }
+}
+
+
+#endif /* INCLUDE_MAPINDEX_HPP_ */
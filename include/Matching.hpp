@@ -25,6 +25,10 @@
 #define INCLUDE_MATCHING_HPP_
 
 #include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <cmath>
 
 #include <opencv2/opencv.hpp>
 
@@ -34,6 +38,11 @@
 
 #include "Types.hpp"
 #include "ObjInstance.hpp"
+#include "ThreadPool.hpp"
+#include "MapIndex.hpp"
+#include "InlineVector.hpp"
+
+class MatchingCache;
 
 class Matching {
 public:
@@ -42,24 +51,31 @@ public:
 		Unknown
 	};
     
+    // maximal number of line segment pairs in a potential match
+    static constexpr int maxLineSubsetCap = 4;
+    
+    typedef InlineVector<int, maxLineSubsetCap> LineIdxs;
+    
+    typedef InlineVector<double, maxLineSubsetCap> LineVals;
+    
     struct PotMatch{
         PotMatch() {}
         
         PotMatch(int plane1,
-                 const std::vector<int> &lineSegs1,
+                 const LineIdxs &lineSegs1,
                  int plane2,
-                 const std::vector<int> &lineSegs2)
+                 const LineIdxs &lineSegs2)
                 : plane1(plane1),
                   lineSegs1(lineSegs1),
                   plane2(plane2),
                   lineSegs2(lineSegs2) {}
         
         PotMatch(int plane1,
-                 const std::vector<int> &lineSegs1,
+                 const LineIdxs &lineSegs1,
                  int plane2,
-                 const std::vector<int> &lineSegs2,
+                 const LineIdxs &lineSegs2,
                  double planeAppDiff,
-                 const std::vector<double> &lineSegAppDiffs)
+                 const LineVals &lineSegAppDiffs)
                 : plane1(plane1),
                   lineSegs1(lineSegs1),
                   plane2(plane2),
@@ -69,25 +85,38 @@ public:
         
         int plane1;
         
-        std::vector<int> lineSegs1;
+        // stored in place, so potential matches and their sets do not allocate
+        LineIdxs lineSegs1;
         
         int plane2;
         
-        std::vector<int> lineSegs2;
+        LineIdxs lineSegs2;
         
         double planeAppDiff;
         
-        std::vector<double> lineSegAppDiffs;
+        LineVals lineSegAppDiffs;
     };
+    
+    // potential matches are verified in sets of 3
+    static constexpr int maxPotSetSize = 3;
+    
+    // indices of potential matches forming a set
+    typedef InlineVector<int, maxPotSetSize> PotSetIdxs;
+    
+    typedef InlineVector<PotMatch, maxPotSetSize> PotMatchSet;
+    
+    typedef InlineVector<double, maxPotSetSize> PlaneVals;
+    
+    typedef InlineVector<LineVals, maxPotSetSize> PlaneLineVals;
 	
     struct ValidTransform{
         ValidTransform()
         {}
         
         ValidTransform(const Vector7d& itransform,
-                       const std::vector<Matching::PotMatch> &imatchSet,
-                       const std::vector<double>& iintAreaPlanes,
-                       const std::vector<std::vector<double>>& iintLenLines)
+                       const PotMatchSet &imatchSet,
+                       const PlaneVals &iintAreaPlanes,
+                       const PlaneLineVals &iintLenLines)
                 : transform(itransform),
                   matchSet(imatchSet),
                   intAreaPlanes(iintAreaPlanes),
@@ -97,23 +126,372 @@ public:
         {}
         Vector7d transform;
         double score;
-        std::vector<Matching::PotMatch> matchSet;
-        std::vector<double> intAreaPlanes;
-        std::vector<std::vector<double> > intLenLines;
+        // stored in place, so hypotheses do not allocate
+        PotMatchSet matchSet;
+        PlaneVals intAreaPlanes;
+        PlaneLineVals intLenLines;
+    };
+	
+    /**
+     * Limits of matching, unlimited by default. Hypotheses are verified in order
+     * of their appearance difference until the deadline passes or maxEvals
+     * hypotheses are verified. The deadline is also checked between the remaining
+     * stages - when it passes, weighting of scores is skipped and transformations
+     * that were not fitted yet are dropped.
+     */
+    struct Budget{
+        Budget()
+                : deadline(std::chrono::steady_clock::time_point::max()),
+                  maxEvals(0)
+        {}
+        
+        Budget(std::chrono::steady_clock::time_point ideadline,
+               int imaxEvals = 0)
+                : deadline(ideadline),
+                  maxEvals(imaxEvals)
+        {}
+        
+        inline bool isLimited() const {
+            return deadline != std::chrono::steady_clock::time_point::max() || maxEvals > 0;
+        }
+        
+        inline bool isExpired() const {
+            return deadline != std::chrono::steady_clock::time_point::max() &&
+                   std::chrono::steady_clock::now() > deadline;
+        }
+        
+        std::chrono::steady_clock::time_point deadline;
+        // 0 - no limit
+        int maxEvals;
+    };
+	
+    /**
+     * Approximate pose of the frame in the map. Covariance of the error is expressed
+     * in the tangent space, ordered as log map of g2o::SE3Quat (rotation first).
+     */
+    struct PosePrior{
+        PosePrior()
+                : isSet(false),
+                  chi2Thresh(16.81)
+        {}
+        
+        PosePrior(const Vector7d &ipose,
+                  const Eigen::Matrix<double, 6, 6> &icovar,
+                  double ichi2Thresh = 16.81)
+                : isSet(true),
+                  pose(ipose),
+                  covar(icovar),
+                  infMat(icovar.inverse()),
+                  chi2Thresh(ichi2Thresh)
+        {}
+        
+        bool isSet;
+        Vector7d pose;
+        Eigen::Matrix<double, 6, 6> covar;
+        Eigen::Matrix<double, 6, 6> infMat;
+        // squared Mahalanobis distance of accepted poses, 99% quantile for 6 DoF by default
+        double chi2Thresh;
+        
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    
+    /**
+     * Parameters of the sequential probability ratio test run before scoring a hypothesis.
+     * Frame planes that are not in the set are transformed to the map one by one and checked
+     * for a map plane with an agreeing equation. The test stops as soon as the likelihood
+     * ratio crosses one of the bounds, and the hypothesis is scored only if it is not rejected.
+     */
+    struct SprtParams{
+        SprtParams()
+                : enabled(false),
+                  pCorrect(0.6),
+                  pWrong(0.05),
+                  falseRejRate(0.05),
+                  falseAccRate(0.05),
+                  angThresh(0.1),
+                  distThresh(0.1)
+        {}
+        
+        // log of the likelihood ratio below which the hypothesis is rejected
+        inline double lowerBound() const {
+            return std::log(falseRejRate / (1.0 - falseAccRate));
+        }
+        
+        // log of the likelihood ratio above which the hypothesis is passed to scoring
+        inline double upperBound() const {
+            return std::log((1.0 - falseRejRate) / falseAccRate);
+        }
+        
+        bool enabled;
+        // probability that a frame plane agrees with some map plane under a correct hypothesis
+        double pCorrect;
+        // the same under a wrong hypothesis
+        double pWrong;
+        // probability of rejecting a correct hypothesis
+        double falseRejRate;
+        // probability of passing a wrong hypothesis without further sampling
+        double falseAccRate;
+        // maximal angle between normals and distance between planes that agree
+        double angThresh;
+        double distThresh;
+    };
+    
+    /**
+     * Counts of hypotheses at the stages of verification, used for tuning thresholds.
+     */
+    struct VerifStats{
+        VerifStats()
+                : numVerified(0),
+                  numSprtRejected(0),
+                  numSprtPassed(0),
+                  numSprtUndecided(0),
+                  numSprtSamples(0),
+                  numScored(0),
+                  numAccepted(0)
+        {}
+        
+        VerifStats &operator+=(const VerifStats &other);
+        
+        // hypotheses with a fully constrained transformation
+        int numVerified;
+        // SPRT decisions, undecided hypotheses ran out of frame planes and are scored
+        int numSprtRejected;
+        int numSprtPassed;
+        int numSprtUndecided;
+        // frame planes checked by SPRT in total
+        int numSprtSamples;
+        // hypotheses scored by projection
+        int numScored;
+        // hypotheses with the score above the threshold
+        int numAccepted;
     };
 	
-	static MatchType matchFrameToMap(const cv::FileStorage &fs,
-									 const vectorObjInstance &frameObjInstances,
-									 const vectorObjInstance &mapObjInstances,
-									 vectorVector7d &bestTrans,
-									 std::vector<double> &bestTransProbs,
-									 std::vector<double> &bestTransFits,
-									 std::vector<int> &bestTransDistinct,
-									 std::vector<Matching::ValidTransform> &retTransforms,
-									 pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
-									 int viewPort1 = -1,
-									 int viewPort2 = -1);
+    /**
+     * Parameters of matching, read once from the "matching" section of settings.
+     */
+    struct Settings{
+        Settings();
+        
+        Settings(const cv::FileStorage &fs);
+        
+        double planeAppThresh;
+        double lineAppThresh;
+        double lineToLineAngThresh;
+        double planeToPlaneAngThresh;
+        double planeToLineAngThresh;
+        double planeDistThresh;
+        double scoreThresh;
+        double sinValsThresh;
+        double planeEqDiffThresh;
+        double intAreaThresh;
+        double lineEqDiffThresh;
+        double intLenThresh;
+        int maxLineSubsetSize;
+        int maxPotMatches;
+        int numThreads;
+        double kernelMaxExp;
+        std::string aggregator;
+        double voteTransCellSize;
+        double voteRotCellSize;
+        int voteNumPeaks;
+        bool voteRefine;
+        ObjInstance::DescriptorThresh descThresh;
+        SprtParams sprtParams;
+        double temporalRotStd;
+        double temporalTransStd;
+        double temporalProbRatio;
+        ConcaveHull::IntersectParams hullIntersect;
+        // bins of the map index, from the "map" section
+        double indexAngBinSize;
+        double indexDistBinSize;
+    };
+    
+    /**
+     * Times of the stages of matching and counts of hypotheses, summed over calls.
+     */
+    struct Stats{
+        Stats();
+        
+        Stats &operator+=(const Stats &other);
+        
+        void print() const;
+        
+        int numCalls;
+        std::chrono::milliseconds appTime;
+        std::chrono::milliseconds tripletsTime;
+        std::chrono::milliseconds transformTime;
+        std::chrono::milliseconds scoreTime;
+        std::chrono::milliseconds fitTime;
+        // time of finding triplets and computing transformations, in ms
+        double triTransTimeSum;
+        double triTransTimeSqSum;
+        double maxTriTransTime;
+        VerifStats verifStats;
+    };
+    
+    /**
+     * Buffers reused between calls, a single call at a time can use them.
+     */
+    struct Scratch{
+        pcl::PointCloud<pcl::PointXYZRGB>::Ptr framePcTrans;
+    };
+    
+    /**
+     * State kept between consecutive localizations of a continuously moving frame.
+     * odomPose is the odometry pose of the frame at the previous fix.
+     */
+    struct TemporalState{
+        TemporalState()
+                : isSet(false)
+        {}
+        
+        inline void reset() {
+            isSet = false;
+            bestTrans.clear();
+        }
+        
+        bool isSet;
+        vectorVector7d bestTrans;
+        Vector7d odomPose;
+        
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    
+    /**
+     * Part of a map matched independently of the others. The index is optional.
+     */
+    struct MapShard{
+        MapShard()
+                : objInstances(nullptr),
+                  index(nullptr)
+        {}
+        
+        MapShard(const vectorObjInstance *iobjInstances,
+                 const MapIndex *iindex)
+                : objInstances(iobjInstances),
+                  index(iindex)
+        {}
+        
+        const vectorObjInstance *objInstances;
+        const MapIndex *index;
+    };
+    
+    /**
+     * Optional inputs of matching, all unset by default.
+     */
+    struct MatchOptions{
+        MatchOptions()
+                : cache(nullptr),
+                  temporalState(nullptr)
+        {
+            odomPose << 0, 0, 0, 0, 0, 0, 1;
+        }
+        
+        Budget budget;
+        // hypotheses are restricted to the confidence region of posePrior if it is set
+        PosePrior posePrior;
+        // used for frame objects that did not change since the previous call if not null
+        MatchingCache *cache;
+        // if not null, the previous fix moved by the odometry increment up to odomPose
+        // is used instead of posePrior and cache, see matchFrameToShards
+        TemporalState *temporalState;
+        Vector7d odomPose;
+        
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    
+    /**
+     * Best transformations with their probabilities, fit scores and numbers of distinct
+     * matched objects, together with all verified transformations.
+     */
+    struct MatchResult{
+        MatchResult()
+                : truncated(false)
+        {}
+        
+        vectorVector7d bestTrans;
+        std::vector<double> bestTransProbs;
+        std::vector<double> bestTransFits;
+        std::vector<int> bestTransDistinct;
+        std::vector<ValidTransform> transforms;
+        // set if some of the hypotheses were not verified within the budget
+        bool truncated;
+        // counts of hypotheses at the stages of verification
+        VerifStats verifStats;
+    };
+    
+    /**
+     * Concurrent calls can share settings and threadPool, but not scratch
+     * and stats. Times and counts of the call are added to stats.
+     * mapIndex is used for generating hypotheses if it was built from mapObjInstances,
+     * otherwise map distances are computed from scratch.
+     */
+    static MatchType matchFrameToMap(const Settings &settings,
+                                     ThreadPool &threadPool,
+                                     Scratch &scratch,
+                                     Stats &stats,
+                                     const vectorObjInstance &frameObjInstances,
+                                     const vectorObjInstance &mapObjInstances,
+                                     const MapIndex *mapIndex,
+                                     const MatchOptions &options,
+                                     MatchResult &result,
+                                     pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
+                                     int viewPort1 = -1,
+                                     int viewPort2 = -1);
+    
+    /**
+     * Hypotheses are generated for every shard in parallel and merged before scoring
+     * and aggregation, so the result is the same as for a single map without matches
+     * between objects of different shards. plane1 of returned transforms indexes
+     * the concatenation of shard objects in the order of mapShards. The cache is used
+     * only if there is a single shard.
+     * If options.temporalState is set, the previous fix moved by the odometry increment
+     * is used as a prior and hypotheses consistent with it are verified first. The full
+     * search runs only if this finds no transformation, or if the best maximum neither
+     * dominates the second one nor is the second one within the prior.
+     * temporalState is updated with the result, or reset if nothing was found.
+     * Without options.cache, the searches of a temporal call share a cache local to the call.
+     */
+    static MatchType matchFrameToShards(const Settings &settings,
+                                        ThreadPool &threadPool,
+                                        Scratch &scratch,
+                                        Stats &stats,
+                                        const vectorObjInstance &frameObjInstances,
+                                        const std::vector<MapShard> &mapShards,
+                                        const MatchOptions &options,
+                                        MatchResult &result,
+                                        pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
+                                        int viewPort1 = -1,
+                                        int viewPort2 = -1);
+    
+    /**
+     * Removes potential matches that are not plausible under the prior - the frame object
+     * transformed by the prior pose has to be close to the map object and similarly oriented.
+     * Margins grow with uncertainty of the prior.
+     */
+    static std::vector<PotMatch> filterPotMatches(const std::vector<PotMatch> &potMatches,
+                                                  const vectorObjInstance &mapObjInstances,
+                                                  const vectorObjInstance &frameObjInstances,
+                                                  const PosePrior &posePrior,
+                                                  double planeToPlaneAngThresh);
+    
+    static bool checkPosePrior(const Vector7d &transform,
+                               const PosePrior &posePrior);
 
+    /**
+     * Runs SPRT over frame planes in frameOrder that are not in curSet. framePlanes
+     * and mapPlanes are oriented normals with distances. Returns false if the hypothesis
+     * is rejected, decision is set to -1 for rejected, 1 for passed and 0 for undecided.
+     */
+    static bool checkSprt(const Vector7d &transform,
+                          const PotMatchSet &curSet,
+                          const vectorVector4d &mapPlanes,
+                          const vectorVector4d &framePlanes,
+                          const std::vector<int> &frameOrder,
+                          const SprtParams &sprtParams,
+                          int &decision,
+                          int &numSamples);
+    
     static double planeEqDiffLogMap(const ObjInstance &obj1,
                                     const ObjInstance &obj2,
                                     const Vector7d &transform);
@@ -126,6 +504,7 @@ public:
                                               const ObjInstance& obj2,
                                               const Vector7d& transform,
                                               double& intArea,
+                                              const ConcaveHull::IntersectParams &hullIntersect = ConcaveHull::IntersectParams(),
                                               pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
                                               int viewPort1 = -1,
                                               int viewPort2 = -1);
@@ -167,29 +546,72 @@ public:
                                         vectorVector3d &retDistPts,
                                         vectorVector3d &retDistPtsDirs);
     
+    /**
+     * Sets of 3 potential matches (i < j < k) whose planes are closer than planeDistThresh
+     * in the map and in the frame, and whose every pair passes checkPotSet.
+     */
+    static std::vector<PotSetIdxs> findPotSets(const std::vector<PotMatch> &potMatches,
+                                               const vectorObjInstance &mapObjInstances,
+                                               const vectorObjInstance &frameObjInstances,
+                                               double planeDistThresh,
+                                               double lineToLineAngThresh,
+                                               double planeToPlaneAngThresh,
+                                               double planeToLineAngThresh,
+                                               ThreadPool &threadPool,
+                                               const MapIndex *mapIndex,
+                                               MatchingCache *cache = nullptr,
+                                               pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
+                                               int viewPort1 = -1,
+                                               int viewPort2 = -1);
+    
+    // every check is made between two elements of the set,
+    // so the set is valid if and only if all its pairs are valid.
+    // Distances between planes are checked by the caller
+    static bool checkPotSet(const PotMatchSet &curSet,
+                            const vectorObjInstance &mapObjInstances,
+                            const vectorObjInstance &frameObjInstances,
+                            double lineToLineAngThresh,
+                            double planeToPlaneAngThresh,
+                            double planeToLineAngThresh);
+    
 private:
-
-	class ProbDistKernel{
-	public:
-		ProbDistKernel(Vector7d ikPt,
-						Eigen::Matrix<double, 6, 6> iinfMat,
-						double iweight);
-
-		double eval(Vector7d pt) const;
-		
-		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-	private:
-		Vector7d kPt;
-
-		g2o::SE3Quat kPtSE3Quat;
-
-		Eigen::Matrix<double, 6, 6> infMat;
-
-		double weight;
-	};
     
-    typedef std::vector<Matching::ProbDistKernel, Eigen::aligned_allocator<Matching::ProbDistKernel> > vectorProbDistKernel;
+    /**
+     * A single search over all shards with the given budget and prior.
+     */
+    static MatchType searchShards(const Settings &settings,
+                                  ThreadPool &threadPool,
+                                  Scratch &scratch,
+                                  Stats &stats,
+                                  const vectorObjInstance &frameObjInstances,
+                                  const std::vector<MapShard> &mapShards,
+                                  const Budget &budget,
+                                  const PosePrior &posePrior,
+                                  MatchingCache *cache,
+                                  MatchResult &result,
+                                  pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
+                                  int viewPort1 = -1,
+                                  int viewPort2 = -1);
     
+    /**
+     * Generates hypotheses from potential sets and verifies them, scores are not set.
+     * Times of the stages are added to stats.
+     */
+    static std::vector<ValidTransform> generateTransforms(const Settings &settings,
+                                                          ThreadPool &threadPool,
+                                                          Stats &stats,
+                                                          const vectorObjInstance &frameObjInstances,
+                                                          const vectorObjInstance &mapObjInstances,
+                                                          const MapIndex *mapIndex,
+                                                          const Budget &budget,
+                                                          const PosePrior &posePrior,
+                                                          bool &truncated,
+                                                          VerifStats &verifStats,
+                                                          MatchingCache *cache,
+                                                          pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
+                                                          int viewPort1 = -1,
+                                                          int viewPort2 = -1);
+
     static double compAngleDiffBetweenNormals(const Eigen::Vector3d &nf1,
 											  const Eigen::Vector3d &ns1,
 											  const Eigen::Vector3d &nf2,
@@ -214,26 +636,42 @@ private:
                                                 double planeAppThresh,
                                                 double lineAppThresh,
                                                 double lineToLineAngThresh,
+                                                const ObjInstance::DescriptorThresh &descThresh,
+                                                int maxLineSubsetSize,
+                                                int maxPotMatches,
+                                                const MapIndex *mapIndex = nullptr,
+                                                MatchingCache *cache = nullptr,
                                                 pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
                                                 int viewPort1 = -1,
                                                 int viewPort2 = -1);
     
-    static std::vector<std::vector<PotMatch> > findPotSets(const std::vector<PotMatch> &potMatches,
-                                                           const vectorObjInstance &mapObjInstances,
-                                                           const vectorObjInstance &frameObjInstances,
-                                                           double planeDistThresh,
-                                                           double lineToLineAngThresh,
-                                                           double planeToPlaneAngThresh,
-                                                           double planeToLineAngThresh,
-                                                           pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
-                                                           int viewPort1 = -1,
-                                                           int viewPort2 = -1);
-    
-	static void compObjFeatures(const vectorObjInstance& objInstances,
-								std::vector<cv::Mat>& objFeats);
-
+    /**
+     * Depth-first enumeration of subsets of potLineMatches starting at startLine,
+     * extending curPotMatch. A branch is pruned as soon as a pair fails the line to line
+     * angle check and subsets are not larger than maxLineSubsetSize.
+     */
+    static void addLineSubsets(const vectorLineSeg &mapLineSegs,
+                               const vectorLineSeg &frameLineSegs,
+                               const std::vector<std::pair<int, int>> &potLineMatches,
+                               const std::vector<double> &linesAppDiffs,
+                               double lineAppThresh,
+                               double lineToLineAngThresh,
+                               int maxLineSubsetSize,
+                               int startLine,
+                               PotMatch &curPotMatch,
+                               std::vector<PotMatch> &potMatches);
+    
+    // keeps at most maxPotMatches matches with the smallest appearance difference (0 - no limit)
+    static void limitPotMatches(std::vector<PotMatch> &potMatches,
+                                int maxPotMatches);
+    
+    static PotMatchSet getPotMatchSet(const std::vector<PotMatch> &potMatches,
+                                      const PotSetIdxs &potSet);
+    
+    // distances of pairs of unchanged objects are taken from cache if not null
     static void compObjDistances(const vectorObjInstance& objInstances,
-                                std::vector<std::vector<double>>& objDistances);
+                                std::vector<std::vector<double>>& objDistances,
+                                MatchingCache *cache = nullptr);
 
 	static void comp3DTransform(const vectorVector4d& planes1,
 								const vectorVector4d& planes2,
@@ -267,26 +705,25 @@ private:
 								std::vector<double>& intAreaPair,
                                 double planeEqDiffThresh,
                                 double intAreaThresh,
+                                const ConcaveHull::IntersectParams &hullIntersect = ConcaveHull::IntersectParams(),
 								pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
 								int viewPort1 = -1,
 								int viewPort2 = -1);
     
     static double scoreTransformByProjection(const Vector7d &transform,
-                                             const std::vector<PotMatch> curSet,
+                                             const PotMatchSet &curSet,
                                              const vectorObjInstance &objInstances1,
                                              const vectorObjInstance &objInstances2,
-                                             std::vector<double> &intAreaPlanes,
-                                             std::vector<std::vector<double> > &intLenLines,
+                                             PlaneVals &intAreaPlanes,
+                                             PlaneLineVals &intLenLines,
                                              double planeEqDiffThresh,
                                              double lineEqDiffThresh,
                                              double intAreaThresh,
                                              double intLenThresh,
+                                             const ConcaveHull::IntersectParams &hullIntersect = ConcaveHull::IntersectParams(),
                                              pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
 											 int viewPort1 = -1,
 											 int viewPort2 = -1);
-
-	static double evalPoint(const Vector7d &pt,
-							const vectorProbDistKernel &dist);
     
     static int countDifferent(const std::set<int> &setIdxs,
                               const vectorObjInstance &objs);
@@ -0,0 +1,106 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_MATCHINGCACHE_HPP_
+#define INCLUDE_MATCHINGCACHE_HPP_
+
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#include "ObjInstance.hpp"
+#include "Matching.hpp"
+
+/**
+ * Results of matching computed for frame objects, kept between calls with the same map.
+ * Entries are keyed by id and version of the object, so objects that were merged or
+ * transformed since the previous call get new entries and unchanged ones are reused.
+ */
+class MatchingCache {
+public:
+    typedef std::pair<int, uint64_t> ObjKey;
+    
+    MatchingCache();
+    
+    /**
+     * Clears the cache if the map or the parameters differ from the previous call.
+     */
+    void prepare(const vectorObjInstance &mapObjInstances,
+                 const std::vector<double> &params);
+    
+    /**
+     * Removes entries of objects that are not present in frameObjInstances,
+     * so that the cache does not grow with objects that were merged or removed.
+     */
+    void retain(const vectorObjInstance &frameObjInstances);
+    
+    /**
+     * Potential matches of obj against the map, plane2 is the index of obj in the frame
+     * at the time they were inserted.
+     * Returns nullptr if they were not computed yet.
+     */
+    const std::vector<Matching::PotMatch> *findPotMatches(const ObjInstance &obj);
+    
+    void insertPotMatches(const ObjInstance &obj,
+                          const std::vector<Matching::PotMatch> &potMatches);
+    
+    bool findDistance(const ObjInstance &obj1,
+                      const ObjInstance &obj2,
+                      double &dist);
+    
+    void insertDistance(const ObjInstance &obj1,
+                        const ObjInstance &obj2,
+                        double dist);
+    
+    inline int getNumHits() const {
+        return numHits;
+    }
+    
+    inline int getNumMisses() const {
+        return numMisses;
+    }
+    
+private:
+    static ObjKey getKey(const ObjInstance &obj);
+    
+    static std::pair<ObjKey, ObjKey> getPairKey(const ObjInstance &obj1,
+                                                const ObjInstance &obj2);
+    
+    void clear();
+    
+    std::vector<ObjKey> mapKeys;
+    
+    std::vector<double> params;
+    
+    std::map<ObjKey, std::vector<Matching::PotMatch>> potMatches;
+    
+    // pairs ordered by keys, distances are symmetric
+    std::map<std::pair<ObjKey, ObjKey>, double> distances;
+    
+    int numHits;
+    
+    int numMisses;
+};
+
+
+#endif /* INCLUDE_MATCHINGCACHE_HPP_ */
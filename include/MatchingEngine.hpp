@@ -0,0 +1,150 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_MATCHINGENGINE_HPP_
+#define INCLUDE_MATCHINGENGINE_HPP_
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include <pcl/visualization/pcl_visualizer.h>
+
+#include "Types.hpp"
+#include "ObjInstance.hpp"
+#include "MapIndex.hpp"
+#include "ThreadPool.hpp"
+#include "Matching.hpp"
+
+/**
+ * Matching of frames to a map with settings parsed once. The map is a set of shards,
+ * each one with its own index. The engine owns the thread pool, buffers reused
+ * between calls and indices of shards, if valid ones were not provided.
+ * match() can be called concurrently for different frames, statistics are
+ * accumulated over all calls.
+ */
+class MatchingEngine {
+public:
+    struct FrameResult {
+        // index of the frame in the batch
+        int frameIdx;
+        
+        Matching::MatchType matchType;
+        
+        Matching::MatchResult result;
+    };
+    
+    /**
+     * mapObjInstances and mapIndex have to outlive the engine. If mapIndex is null
+     * or was not built from mapObjInstances, the engine builds its own index.
+     */
+    MatchingEngine(const Matching::Settings &settings,
+                   const vectorObjInstance &mapObjInstances,
+                   const MapIndex *mapIndex = nullptr);
+    
+    /**
+     * Every element of shardObjInstances is a separate shard with an index built
+     * by the engine. shardObjInstances has to outlive the engine.
+     */
+    MatchingEngine(const Matching::Settings &settings,
+                   const std::vector<vectorObjInstance> &shardObjInstances);
+    
+    MatchingEngine(const MatchingEngine &other) = delete;
+    
+    MatchingEngine &operator=(const MatchingEngine &other) = delete;
+    
+    /**
+     * options.temporalState belongs to a single sequence of frames and must not be
+     * shared by concurrent calls.
+     */
+    Matching::MatchType match(const vectorObjInstance &frameObjInstances,
+                              const Matching::MatchOptions &options,
+                              Matching::MatchResult &result,
+                              pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
+                              int viewPort1 = -1,
+                              int viewPort2 = -1);
+    
+    /**
+     * Matches every frame of the batch to the map. Frames are distributed over the
+     * thread pool and the result of each frame is passed to callback as soon as
+     * the frame is done, so results arrive out of order. Calls of callback are
+     * serialized. Returns when all frames are processed.
+     */
+    void matchFramesToMap(const std::vector<vectorObjInstance> &frames,
+                          const std::function<void(const FrameResult &)> &callback);
+    
+    /**
+     * Adds a shard and returns its number, other shards stay untouched. objInstances and
+     * index have to outlive the shard. If the index is not valid, it is built when buildIndex
+     * is set, otherwise the shard is matched without an index, which is cheaper for
+     * a shard used only once. Must not be called concurrently with matching.
+     */
+    int addShard(const vectorObjInstance &objInstances,
+                 const MapIndex *index = nullptr,
+                 bool buildIndex = true);
+    
+    /**
+     * Removes the shard, numbers of the following shards are decreased.
+     * Must not be called concurrently with matching.
+     */
+    void removeShard(int shardIdx);
+    
+    inline int getNumShards() const {
+        return mapShards.size();
+    }
+    
+    inline const Matching::Settings &getSettings() const {
+        return settings;
+    }
+    
+    /**
+     * Statistics summed over all calls so far.
+     */
+    Matching::Stats getStats() const;
+    
+private:
+    std::unique_ptr<Matching::Scratch> acquireScratch();
+    
+    void release(std::unique_ptr<Matching::Scratch> scratch,
+                 const Matching::Stats &callStats);
+    
+    Matching::Settings settings;
+    
+    ThreadPool threadPool;
+    
+    std::vector<Matching::MapShard> mapShards;
+    
+    // indices built by the engine, null for shards with a valid index provided
+    std::vector<std::unique_ptr<MapIndex>> ownMapIndices;
+    
+    mutable std::mutex engineMutex;
+    
+    // buffers not used by any call at the moment
+    std::vector<std::unique_ptr<Matching::Scratch>> freeScratches;
+    
+    Matching::Stats stats;
+};
+
+
+#endif /* INCLUDE_MATCHINGENGINE_HPP_ */
@@ -0,0 +1,105 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_OBJGRID_HPP_
+#define INCLUDE_OBJGRID_HPP_
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include "ObjInstance.hpp"
+
+/**
+ * Uniform grid over bounding boxes of object instance hulls. Every cell keeps ids of
+ * objects whose bounding box overlaps it, so objects that can be merged with a given
+ * object are looked up in its vicinity instead of scanning the whole map.
+ * Candidates are additionally filtered by the angle between normals.
+ */
+class ObjGrid {
+public:
+    ObjGrid();
+    
+    /**
+     * @param cellSize Edge of a cubic cell.
+     * @param margin Bounding boxes are expanded by margin when querying.
+     * @param normalDotThresh Minimal dot product of normals of candidates.
+     */
+    ObjGrid(double cellSize,
+            double margin,
+            double normalDotThresh);
+    
+    void insert(const ObjInstance &obj);
+    
+    void remove(int id);
+    
+    /**
+     * Has to be called after hull or plane of the object changed.
+     */
+    void update(const ObjInstance &obj);
+    
+    void clear();
+    
+    inline int size() const {
+        return entries.size();
+    }
+    
+    /**
+     * Ids of objects near obj with a similar normal, sorted. If obj is in the grid,
+     * its own id is included.
+     */
+    std::vector<int> getCandidates(const ObjInstance &obj) const;
+    
+private:
+    struct Entry {
+        Eigen::Vector3d normal;
+        
+        Eigen::Vector3d minPt, maxPt;
+        
+        std::vector<int64_t> cells;
+    };
+    
+    static void compBoundingBox(const ObjInstance &obj,
+                                Eigen::Vector3d &minPt,
+                                Eigen::Vector3d &maxPt);
+    
+    void compCells(const Eigen::Vector3d &minPt,
+                   const Eigen::Vector3d &maxPt,
+                   std::vector<int64_t> &retCells) const;
+    
+    double cellSize;
+    
+    double margin;
+    
+    double normalDotThresh;
+    
+    std::map<int, Entry> entries;
+    
+    std::unordered_map<int64_t, std::vector<int>> cells;
+};
+
+
+#endif /* INCLUDE_OBJGRID_HPP_ */
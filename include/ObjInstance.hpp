@@ -28,6 +28,8 @@ class ObjInstance;
 
 #include <vector>
 #include <string>
+#include <iterator>
+#include <cstdint>
 
 #include <boost/serialization/vector.hpp>
 
@@ -80,6 +82,14 @@ public:
     inline void setId(int nid){
         id = nid;
     }
+    
+    /**
+     * Changes every time the object is modified, unique among all objects,
+     * so that (id, version) identifies the content of the object.
+     */
+    inline uint64_t getVersion() const {
+        return objVersion;
+    }
 
 	inline ObjType getType() const {
 		return type;
@@ -176,6 +186,7 @@ public:
     
     inline void addLineSeg(const LineSeg &newLineSeg){
         lineSegs.push_back(newLineSeg);
+        objVersion = newVersion();
     }
     
     cv::Mat getColorHist() const {
@@ -183,11 +194,87 @@ public:
     }
     
     bool isMatching(const ObjInstance &other,
+                    const ConcaveHull::IntersectParams &hullIntersect = ConcaveHull::IntersectParams(),
+                    pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
+                    int viewPort1 = -1,
+                    int viewPort2 = -1) const;
+    
+    /**
+     * Checks if this object transformed by transform matches the other one.
+     * Neither this object nor its hull is transformed.
+     */
+    bool isMatching(const ObjInstance &other,
+                    const Vector7d &transform,
+                    const ConcaveHull::IntersectParams &hullIntersect = ConcaveHull::IntersectParams(),
                     pcl::visualization::PCLVisualizer::Ptr viewer = nullptr,
                     int viewPort1 = -1,
                     int viewPort2 = -1) const;
     
     static double compHistDist(cv::Mat hist1, cv::Mat hist2);
+    
+    // 32 bins of hue and 32 bins of saturation
+    static constexpr int histBins = 64;
+    
+    typedef Eigen::Matrix<float, Eigen::Dynamic, histBins, Eigen::RowMajor> HistMatrix;
+    
+    /**
+     * Color histograms of objects in consecutive rows.
+     */
+    template<class Iterator>
+    static void compHistMatrix(Iterator beg, Iterator end, HistMatrix &hists);
+    
+    /**
+     * L1 distances between histograms, dists(r1, r2) is the distance between
+     * hists1.row(r1) and hists2.row(r2).
+     */
+    static void compHistDistMatrix(const HistMatrix &hists1,
+                                   const HistMatrix &hists2,
+                                   Eigen::MatrixXf &dists);
+    
+    // sums of groups of 4 consecutive bins
+    static constexpr int coarseHistBins = histBins / 4;
+    
+    /**
+     * Compact description of the object used for rejecting incompatible pairs
+     * before comparing full histograms and line segments.
+     */
+    struct Descriptor{
+        double area;
+        
+        // standard deviations of points along two largest principal components
+        Eigen::Vector2d extents;
+        
+        double curv;
+        
+        Eigen::Matrix<float, coarseHistBins, 1> coarseHist;
+        
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    
+    struct DescriptorThresh{
+        // maximal ratio of frame to map areas, 0 - not tested
+        double maxAreaRatio;
+        
+        // maximal ratio of frame to map extents, 0 - not tested
+        double maxExtRatio;
+        
+        // 0 - not tested
+        double maxCurvDiff;
+        
+        double maxHistDist;
+    };
+    
+    Descriptor compDescriptor() const;
+    
+    /**
+     * Cascade of tests, cheapest first. Frame objects are usually observed partially,
+     * so they are only required not to be much larger than map objects.
+     * L1 distance of coarse histograms is not larger than the one of full histograms,
+     * so no pair with histogram distance below maxHistDist is rejected by it.
+     */
+    static bool checkDescriptors(const Descriptor &frameDesc,
+                                 const Descriptor &mapDesc,
+                                 const DescriptorThresh &thresh);
    
     
     void display(pcl::visualization::PCLVisualizer::Ptr viewer,
@@ -199,6 +286,8 @@ public:
     
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 private:
+    static uint64_t newVersion();
+    
     void correctOrient();
     
     void compColorHist();
@@ -241,6 +330,9 @@ private:
     
     bool trial;
     
+    // not serialized, loaded objects get a new one
+    uint64_t objVersion;
+    
     friend class boost::serialization::access;
     
     template<class Archive>
@@ -264,9 +356,27 @@ private:
         ar & eolCnt;
         ar & obsCnt;
         ar & trial;
+        if(Archive::is_loading::value){
+            objVersion = newVersion();
+        }
     }
 };
 
+typedef std::vector<ObjInstance::Descriptor, Eigen::aligned_allocator<ObjInstance::Descriptor> > vectorObjDescriptor;
+
+template<class Iterator>
+void ObjInstance::compHistMatrix(Iterator beg, Iterator end, HistMatrix &hists) {
+    hists.resize(std::distance(beg, end), Eigen::NoChange);
+    int r = 0;
+    for(Iterator it = beg; it != end; ++it, ++r){
+        cv::Mat hist = it->getColorHist();
+        // histograms are continuous float columns
+        for(int b = 0; b < histBins; ++b){
+            hists(r, b) = hist.at<float>(b);
+        }
+    }
+}
+
 
 
 #endif /* INCLUDE_OBJINSTANCE_HPP_ */
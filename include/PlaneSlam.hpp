@@ -31,6 +31,8 @@
 
 #include "FileGrabber.hpp"
 #include "Map.hpp"
+#include "Matching.hpp"
+#include "MatchingEngine.hpp"
 
 class PlaneSlam{
 public:
@@ -49,7 +51,10 @@ private:
     
 	void evaluateMatching(const cv::FileStorage &fs,
                               const vectorObjInstance &objInstances1,
-                              const vectorObjInstance &objInstances2,
+                              MatchingEngine *engine,
+                              const vectorObjInstance *oneShotShard,
+                              Matching::TemporalState *temporalState,
+                              const Vector7d &odomPose,
                               std::ifstream &inputResFile,
                               std::ofstream &outputResFile,
                               const Vector7d &gtTransform,
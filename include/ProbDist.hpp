@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_PROBDIST_HPP_
+#define INCLUDE_PROBDIST_HPP_
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include <g2o/types/slam3d/se3quat.h>
+
+#include "Types.hpp"
+
+/**
+ * Sum of gaussian kernels over SE(3), exp(-d^T * infMat * d) with d being the log map
+ * of the relative transformation. Kernels are bucketed in a hash grid by their
+ * translations, so only kernels within the cutoff radius are evaluated.
+ * For the log map ||d||^2 >= ||t1 - t2||^2 + angle(R1, R2)^2, so kernels contributing
+ * less than exp(-maxExp) * weight are skipped without computing it.
+ */
+class ProbDist {
+public:
+    /**
+     * @param maxExp Kernels with exponent greater than maxExp are treated as 0.
+     */
+    ProbDist(const Eigen::Matrix<double, 6, 6> &infMat,
+             double maxExp = 20.0);
+    
+    void addKernel(const Vector7d &kPt, double weight);
+    
+    double eval(const Vector7d &pt) const;
+    
+    inline int size() const {
+        return kernels.size();
+    }
+    
+    inline double getCutoffRadius() const {
+        return cutoffRad;
+    }
+    
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+private:
+    struct Kernel {
+        g2o::SE3Quat kPtSE3Quat;
+        
+        Eigen::Vector3d t;
+        
+        Eigen::Quaterniond q;
+        
+        double weight;
+        
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    
+    int64_t compCellKey(const Eigen::Vector3d &t) const;
+    
+    Eigen::Matrix<double, 6, 6> infMat;
+    
+    double cutoffRad;
+    
+    std::vector<Kernel, Eigen::aligned_allocator<Kernel>> kernels;
+    
+    std::unordered_map<int64_t, std::vector<int>> cells;
+};
+
+
+#endif /* INCLUDE_PROBDIST_HPP_ */
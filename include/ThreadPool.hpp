@@ -0,0 +1,111 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_THREADPOOL_HPP_
+#define INCLUDE_THREADPOOL_HPP_
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/**
+ * Work-stealing thread pool. Every worker owns a deque of tasks - it takes
+ * tasks from the back of its own deque and steals from the front of the others.
+ * The thread calling parallelFor takes part in the computation, so the pool
+ * of n threads spawns n - 1 workers and calls can be nested.
+ */
+class ThreadPool {
+public:
+    /**
+     * @param numThreads Number of threads including the calling one.
+     *                   Values <= 0 select std::thread::hardware_concurrency().
+     */
+    ThreadPool(int numThreads);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &other) = delete;
+
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    inline int getNumThreads() const {
+        return workers.size() + 1;
+    }
+
+    /**
+     * Splits [0, numItems) into consecutive chunks of chunkSize items and calls
+     * func(chunkIdx, beg, end) for every chunk. Returns when all chunks are done.
+     * The first exception thrown by func is rethrown in the calling thread.
+     * Chunk indices are ordered, so results stored per chunk can be merged
+     * in the same order as in a serial loop.
+     */
+    void parallelFor(int numItems,
+                     int chunkSize,
+                     const std::function<void(int, int, int)> &func);
+
+    /**
+     * Number of chunks parallelFor will create.
+     */
+    static int numChunks(int numItems, int chunkSize);
+
+    /**
+     * Chunk size giving a few chunks per thread, so that work can be stolen
+     * when chunks are not equally expensive.
+     */
+    int chooseChunkSize(int numItems, int chunksPerThread = 8) const;
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void push(int queueIdx, std::function<void()> &&task);
+
+    bool tryRunOne(int ownQueueIdx);
+
+    void workerLoop(int queueIdx);
+
+    // one queue per worker and one shared by external callers
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+    std::vector<std::thread> workers;
+
+    std::atomic<int> numQueued;
+
+    std::atomic<unsigned> nextQueue;
+
+    std::mutex wakeMutex;
+
+    std::condition_variable wakeCv;
+
+    bool stop;
+};
+
+
+#endif /* INCLUDE_THREADPOOL_HPP_ */
@@ -0,0 +1,84 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_VOTEACCUM_HPP_
+#define INCLUDE_VOTEACCUM_HPP_
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include "Types.hpp"
+
+/**
+ * Sparse hashed accumulator of votes over SE(3). Translation is quantized into cubic
+ * cells of transCellSize and rotation into cubic cells of rotCellSize over its
+ * axis-angle representation. Every cell keeps the sum of weights of its votes and
+ * the id of the vote with the largest weight, which represents the cell.
+ */
+class VoteAccum {
+public:
+    VoteAccum(double transCellSize,
+              double rotCellSize);
+    
+    void addVote(const Vector7d &pose, double weight, int id);
+    
+    // sum of weights in the cell of pose
+    double eval(const Vector7d &pose) const;
+    
+    /**
+     * Returns (value, id of the representative vote) of numPeaks cells with the largest
+     * sums of weights, in order of decreasing value. Cells are selected in linear time.
+     * If refine is set, values of the selected cells are replaced with sums over the cell
+     * and its 3^6 - 1 neighbours, to merge peaks split by cell borders.
+     */
+    std::vector<std::pair<double, int>> getPeaks(int numPeaks, bool refine) const;
+    
+    inline int size() const {
+        return cells.size();
+    }
+    
+private:
+    struct Cell {
+        Cell() : weight(0.0), bestWeight(0.0), bestId(-1) {}
+        
+        double weight;
+        
+        double bestWeight;
+        
+        int bestId;
+    };
+    
+    void compCellCoords(const Vector7d &pose, int64_t coords[6]) const;
+    
+    double transCellSize;
+    
+    double rotCellSize;
+    
+    std::unordered_map<int64_t, Cell> cells;
+};
+
+
+#endif /* INCLUDE_VOTEACCUM_HPP_ */
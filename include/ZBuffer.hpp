@@ -0,0 +1,113 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INCLUDE_ZBUFFER_HPP_
+#define INCLUDE_ZBUFFER_HPP_
+
+#include <vector>
+#include <map>
+
+#include <opencv2/opencv.hpp>
+
+#include <Eigen/Eigen>
+
+#include "Types.hpp"
+
+/**
+ * Depth buffer of planar polygons in the image. Polygons are rasterized with scanlines
+ * at pixel centers and the depth of every pixel is computed from the plane equation,
+ * because inverse of depth is an affine function of image coordinates. Spans of all
+ * added objects are kept, so that pixels near the nearest surface can be counted
+ * after all objects were added. Buffers are reused between frames.
+ */
+class ZBuffer {
+public:
+    ZBuffer();
+    
+    /**
+     * Clears the buffer and resizes it if needed.
+     */
+    void reset(int rows, int cols, const cv::Mat &cameraMatrix);
+    
+    /**
+     * Adds polygons in image coordinates of an object lying on a plane
+     * given in the camera frame.
+     */
+    void addObj(int id,
+                const std::vector<vectorVector2d> &polys,
+                const Eigen::Vector4d &planeEq);
+    
+    /**
+     * Increments idToCnt for every pixel of an object not farther than depthTol
+     * from the nearest surface and nearer than maxDepth.
+     */
+    void countVisible(double depthTol,
+                      double maxDepth,
+                      std::map<int, int> &idToCnt) const;
+    
+    inline int getRows() const {
+        return rows;
+    }
+    
+    inline int getCols() const {
+        return cols;
+    }
+    
+    /**
+     * Depth of the nearest surface, infinity if there is none.
+     */
+    inline float getDepth(int r, int c) const {
+        return depth[r * cols + c];
+    }
+    
+private:
+    struct Span {
+        int row;
+        
+        int beg, end;
+        
+        int obj;
+    };
+    
+    struct ObjPlane {
+        int id;
+        
+        // inverse of depth is a * u + b * v + c
+        double a, b, c;
+    };
+    
+    int rows, cols;
+    
+    double fx, fy, cx, cy;
+    
+    std::vector<float> depth;
+    
+    std::vector<Span> spans;
+    
+    std::vector<ObjPlane> objs;
+    
+    std::vector<double> crossings;
+};
+
+
+#endif /* INCLUDE_ZBUFFER_HPP_ */
@@ -6,6 +6,9 @@
 
 #include <iostream>
 #include <map>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 
 #include <pcl/ModelCoefficients.h>
@@ -23,7 +26,102 @@
 
 using namespace std;
 
-ConcaveHull::ConcaveHull() : totalArea(0.0) {}
+// triangle of a fan decomposition of a polygon, vertices in counterclockwise order
+struct FanTriangle {
+    Eigen::Vector2d v[3];
+    // -1 if the triangle was clockwise in the polygon
+    double sign;
+    Eigen::Vector2d minPt, maxPt;
+    
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::vector<FanTriangle, Eigen::aligned_allocator<FanTriangle> > vectorFanTriangle;
+
+// decomposes a simple polygon into triangles sharing the first vertex, so that
+// the sum of signed indicator functions of triangles equals the one of the polygon
+static void fanTriangulate(const vectorVector2d &poly,
+                           vectorFanTriangle &triangles)
+{
+    // clockwise polygons have negative sum of signs inside
+    double polyArea = 0.0;
+    for(int i = 0; i < poly.size(); ++i){
+        const Eigen::Vector2d &cur = poly[i];
+        const Eigen::Vector2d &next = poly[(i + 1) % poly.size()];
+        polyArea += cur.x() * next.y() - cur.y() * next.x();
+    }
+    double polySign = polyArea < 0.0 ? -1.0 : 1.0;
+    
+    for(int i = 1; i + 1 < poly.size(); ++i){
+        FanTriangle tri;
+        tri.v[0] = poly[0];
+        tri.v[1] = poly[i];
+        tri.v[2] = poly[i + 1];
+        Eigen::Vector2d e1 = tri.v[1] - tri.v[0];
+        Eigen::Vector2d e2 = tri.v[2] - tri.v[0];
+        double cross = e1.x() * e2.y() - e1.y() * e2.x();
+        // degenerate triangles do not contribute to the area
+        if(cross == 0.0){
+            continue;
+        }
+        tri.sign = polySign;
+        if(cross < 0.0){
+            swap(tri.v[1], tri.v[2]);
+            tri.sign = -polySign;
+        }
+        tri.minPt = tri.v[0].cwiseMin(tri.v[1]).cwiseMin(tri.v[2]);
+        tri.maxPt = tri.v[0].cwiseMax(tri.v[1]).cwiseMax(tri.v[2]);
+        triangles.push_back(tri);
+    }
+}
+
+// area of intersection of two counterclockwise triangles, Sutherland-Hodgman clipping
+// of the first triangle by edges of the second one
+static double triangleIntersectionArea(const FanTriangle &tri1,
+                                       const FanTriangle &tri2)
+{
+    // every clipping edge adds at most one vertex
+    Eigen::Vector2d bufA[9], bufB[9];
+    Eigen::Vector2d *in = bufA;
+    Eigen::Vector2d *out = bufB;
+    int nIn = 3;
+    for(int i = 0; i < 3; ++i){
+        in[i] = tri1.v[i];
+    }
+    for(int e = 0; e < 3 && nIn > 0; ++e){
+        const Eigen::Vector2d &a = tri2.v[e];
+        const Eigen::Vector2d &b = tri2.v[(e + 1) % 3];
+        Eigen::Vector2d edge = b - a;
+        int nOut = 0;
+        for(int i = 0; i < nIn; ++i){
+            const Eigen::Vector2d &cur = in[i];
+            const Eigen::Vector2d &next = in[(i + 1) % nIn];
+            // positive on the inner (left) side of the edge
+            double curSide = edge.x() * (cur.y() - a.y()) - edge.y() * (cur.x() - a.x());
+            double nextSide = edge.x() * (next.y() - a.y()) - edge.y() * (next.x() - a.x());
+            if(curSide >= 0.0){
+                out[nOut++] = cur;
+            }
+            if((curSide >= 0.0) != (nextSide >= 0.0)){
+                double t = curSide / (curSide - nextSide);
+                out[nOut++] = cur + t * (next - cur);
+            }
+        }
+        swap(in, out);
+        nIn = nOut;
+    }
+    double area = 0.0;
+    for(int i = 0; i < nIn; ++i){
+        const Eigen::Vector2d &cur = in[i];
+        const Eigen::Vector2d &next = in[(i + 1) % nIn];
+        area += cur.x() * next.y() - cur.y() * next.x();
+    }
+    return 0.5 * area;
+}
+
+ConcaveHull::ConcaveHull()
+    : totalArea(0.0)
+{}
 
 ConcaveHull::ConcaveHull(pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr points3d,
                          const Eigen::Vector4d &planeEq)
@@ -60,6 +158,8 @@ ConcaveHull::ConcaveHull(const vector<ConcaveHull::Polygon_2> &ipolygons,
 ConcaveHull::ConcaveHull(const ConcaveHull &other)
 {
     polygons = other.polygons;
+    polygonsie = other.polygonsie;
+    raster = atomic_load(&other.raster);
     areas = other.areas;
     totalArea = other.totalArea;
 //    polygons3d = other.polygons3d;
@@ -68,11 +168,12 @@ ConcaveHull::ConcaveHull(const ConcaveHull &other)
         pcl::copyPointCloud(*opc, *opcCopy);
         polygons3d.push_back(opcCopy);
     }
-    plNormal;
-    plD;
-    origin;
-    xAxis;
-    yAxis;
+    // raster intersections use the plane frame of both hulls
+    plNormal = other.plNormal;
+    plD = other.plD;
+    origin = other.origin;
+    xAxis = other.xAxis;
+    yAxis = other.yAxis;
 }
 
 void ConcaveHull::init(pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr points3d,
@@ -254,6 +355,9 @@ void ConcaveHull::init(pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr points3d,
             }
         }
     }
+    
+    computeInexact();
+    atomic_store(&raster, shared_ptr<const Raster>());
 }
 
 void ConcaveHull::init(const vector<ConcaveHull::Polygon_2> &ipolygons,
@@ -278,6 +382,9 @@ void ConcaveHull::init(const vector<ConcaveHull::Polygon_2> &ipolygons,
         areas.push_back(abs(area));
         totalArea += abs(area);
     }
+    
+    computeInexact();
+    atomic_store(&raster, shared_ptr<const Raster>());
 }
 
 ConcaveHull ConcaveHull::transform(const Vector7d &transform) const {
@@ -424,6 +531,75 @@ ConcaveHull::intersect(const std::vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr>
                        yAxis);
 }
 
+ConcaveHull::IntersectParams ConcaveHull::readIntersectParams(const cv::FileNode &node) {
+    IntersectParams params;
+    string mode = (string)node["hullIntersectMode"];
+    if(mode == "inexact"){
+        params.mode = IntersectMode::Inexact;
+    }
+    else if(mode == "raster"){
+        params.mode = IntersectMode::Raster;
+        params.rasterCellSize = (double)node["hullRasterCellSize"];
+    }
+    else{
+        params.mode = IntersectMode::Exact;
+    }
+    return params;
+}
+
+double ConcaveHull::intersectArea(const ConcaveHull &other,
+                                  const IntersectParams &params) const
+{
+    if(params.mode == IntersectMode::Exact){
+        return intersect(other, 0.0).getTotalArea();
+    }
+    if(params.mode == IntersectMode::Raster){
+        return intersectAreaRaster(other, Eigen::Matrix4d::Identity(), params.rasterCellSize);
+    }
+    return intersectAreaInexact(other, Eigen::Matrix4d::Identity());
+}
+
+double ConcaveHull::intersectAreaInexact(const ConcaveHull &other,
+                                         const Eigen::Matrix4d &otherTransformMat) const
+{
+    Eigen::Matrix3d R = otherTransformMat.block<3, 3>(0, 0);
+    Eigen::Vector3d t = otherTransformMat.block<3, 1>(0, 3);
+    
+    vectorFanTriangle triangles;
+    for(const Polygon_2ie &poly : polygonsie){
+        vectorVector2d poly2d;
+        for(auto it = poly.vertices_begin(); it != poly.vertices_end(); ++it){
+            poly2d.emplace_back(it->x(), it->y());
+        }
+        fanTriangulate(poly2d, triangles);
+    }
+    // transform points and project them onto plane of this hull
+    vectorFanTriangle otherTriangles;
+    for(pcl::PointCloud<pcl::PointXYZRGB>::Ptr poly3d : other.getPolygons3d()){
+        vectorVector2d poly2d;
+        for(auto it = poly3d->begin(); it != poly3d->end(); ++it){
+            Point_2ie pt = point3dTo2die(R * it->getVector3fMap().cast<double>() + t);
+            poly2d.emplace_back(pt.x(), pt.y());
+        }
+        fanTriangulate(poly2d, otherTriangles);
+    }
+    
+    // intersection of polygons is a sum of signed intersections of their fan triangles
+    double intArea = 0.0;
+    for(const FanTriangle &tri : triangles){
+        for(const FanTriangle &otherTri : otherTriangles){
+            if((tri.maxPt.array() < otherTri.minPt.array()).any() ||
+               (otherTri.maxPt.array() < tri.minPt.array()).any())
+            {
+                continue;
+            }
+            intArea += tri.sign * otherTri.sign * triangleIntersectionArea(tri, otherTri);
+        }
+    }
+    
+    return max(intArea, 0.0);
+}
+
 ConcaveHull
 ConcaveHull::clipToCameraFrustum(const cv::Mat K, int rows, int cols, double minZ)
 {
@@ -497,7 +673,7 @@ double ConcaveHull::minDistance(const ConcaveHull &other) const {
                     Eigen::Vector3f pt1 = pt.getVector3fMap();
                     Eigen::Vector3f pt2 = otherPt.getVector3fMap();
                     double curDist = (pt1 - pt2).norm();
-                    minDist = min(curDist, curDist);
+                    minDist = min(minDist, curDist);
                 }
             }
         }
@@ -506,6 +682,29 @@ double ConcaveHull::minDistance(const ConcaveHull &other) const {
     return minDist;
 }
 
+double ConcaveHull::intersectArea(const ConcaveHull &other,
+                                  const Vector7d &otherTransform,
+                                  const IntersectParams &params) const
+{
+    if(params.mode == IntersectMode::Exact){
+        return intersectArea(other.transform(otherTransform), params);
+    }
+    Eigen::Matrix4d otherTransformMat = g2o::SE3Quat(otherTransform).to_homogeneous_matrix();
+    if(params.mode == IntersectMode::Raster){
+        return intersectAreaRaster(other, otherTransformMat, params.rasterCellSize);
+    }
+    // points of the other hull are transformed on the fly, without building a new hull
+    return intersectAreaInexact(other, otherTransformMat);
+}
+
+void ConcaveHull::computeExact() const {
+    for(const Polygon_2 &poly : polygons){
+        for(auto it = poly.vertices_begin(); it != poly.vertices_end(); ++it){
+            CGAL::exact(*it);
+        }
+    }
+}
+
 void ConcaveHull::display(pcl::visualization::PCLVisualizer::Ptr viewer,
                           int vp,
                           double r,
@@ -617,6 +816,155 @@ ConcaveHull::Point_2ie ConcaveHull::point3dTo2die(const Eigen::Vector3d &point3d
                      (point3d - origin).dot(yAxis));
 }
 
+void ConcaveHull::computeInexact() {
+    polygonsie.clear();
+    for(const Polygon_2 &poly : polygons){
+        Polygon_2ie polyie;
+        for(auto it = poly.vertices_begin(); it != poly.vertices_end(); ++it){
+            polyie.push_back(Point_2ie(CGAL::to_double(it->x()), CGAL::to_double(it->y())));
+        }
+        polygonsie.push_back(polyie);
+    }
+}
+
+std::shared_ptr<const ConcaveHull::Raster> ConcaveHull::computeRaster(double cellSize) const {
+    shared_ptr<Raster> curRaster(new Raster());
+    curRaster->cellSize = cellSize;
+    curRaster->origin = Eigen::Vector2d::Zero();
+    curRaster->rows = 0;
+    curRaster->cols = 0;
+    curRaster->rowWords = 0;
+    if(polygonsie.empty()){
+        return curRaster;
+    }
+    
+    Eigen::Vector2d minPt(numeric_limits<double>::max(), numeric_limits<double>::max());
+    Eigen::Vector2d maxPt(-numeric_limits<double>::max(), -numeric_limits<double>::max());
+    for(const Polygon_2ie &poly : polygonsie){
+        for(auto it = poly.vertices_begin(); it != poly.vertices_end(); ++it){
+            minPt = minPt.cwiseMin(Eigen::Vector2d(it->x(), it->y()));
+            maxPt = maxPt.cwiseMax(Eigen::Vector2d(it->x(), it->y()));
+        }
+    }
+    if((maxPt.array() < minPt.array()).any()){
+        return curRaster;
+    }
+    curRaster->origin = minPt;
+    curRaster->cols = (int)ceil((maxPt.x() - minPt.x()) / cellSize) + 1;
+    curRaster->rows = (int)ceil((maxPt.y() - minPt.y()) / cellSize) + 1;
+    curRaster->rowWords = (curRaster->cols + 63) / 64;
+    curRaster->cells.assign(curRaster->rows * curRaster->rowWords, 0);
+    
+    // even-odd scanline filling at cell centers, polygons of a hull do not overlap
+    vector<double> crossings;
+    for(int r = 0; r < curRaster->rows; ++r){
+        double y = curRaster->origin.y() + (r + 0.5) * cellSize;
+        crossings.clear();
+        for(const Polygon_2ie &poly : polygonsie){
+            for(int i = 0; i < poly.size(); ++i){
+                const Point_2ie &cur = poly[i];
+                const Point_2ie &next = poly[(i + 1) % poly.size()];
+                if((cur.y() > y) != (next.y() > y)){
+                    double t = (y - cur.y()) / (next.y() - cur.y());
+                    crossings.push_back(cur.x() + t * (next.x() - cur.x()));
+                }
+            }
+        }
+        sort(crossings.begin(), crossings.end());
+        
+        uint64_t *row = &curRaster->cells[r * curRaster->rowWords];
+        for(int c = 0; c + 1 < crossings.size(); c += 2){
+            // cells with centers in [crossings[c], crossings[c + 1])
+            int beg = max((int)ceil((crossings[c] - curRaster->origin.x()) / cellSize - 0.5), 0);
+            int end = min((int)ceil((crossings[c + 1] - curRaster->origin.x()) / cellSize - 0.5), curRaster->cols);
+            for(int col = beg; col < end; ){
+                int w = col / 64;
+                int b = col % 64;
+                int cnt = min(end - col, 64 - b);
+                uint64_t mask = (cnt == 64) ? ~uint64_t(0) : (((uint64_t(1) << cnt) - 1) << b);
+                row[w] |= mask;
+                col += cnt;
+            }
+        }
+    }
+    
+    return curRaster;
+}
+
+std::shared_ptr<const ConcaveHull::Raster> ConcaveHull::getRaster(double cellSize) const {
+    shared_ptr<const Raster> curRaster = atomic_load(&raster);
+    if(!curRaster || curRaster->cellSize != cellSize){
+        curRaster = computeRaster(cellSize);
+        atomic_store(&raster, curRaster);
+    }
+    return curRaster;
+}
+
+double ConcaveHull::intersectAreaRaster(const ConcaveHull &other,
+                                        const Eigen::Matrix4d &otherTransformMat,
+                                        double rasterCellSize) const
+{
+    shared_ptr<const Raster> curRaster = getRaster(rasterCellSize);
+    shared_ptr<const Raster> otherRaster = other.getRaster(rasterCellSize);
+    
+    Eigen::Matrix3d R = otherTransformMat.block<3, 3>(0, 0);
+    Eigen::Vector3d t = otherTransformMat.block<3, 1>(0, 3);
+    // frame of the other hull expressed in the frame of this hull
+    Eigen::Vector3d otherNormal = R * other.plNormal;
+    Eigen::Vector3d otherOrigin = R * other.origin + t;
+    Eigen::Vector3d otherXAxis = R * other.xAxis;
+    Eigen::Vector3d otherYAxis = R * other.yAxis;
+    
+    double cosAng = plNormal.dot(otherNormal);
+    // projection of perpendicular planes is degenerate
+    if(abs(cosAng) < 1e-3){
+        return 0.0;
+    }
+    // cell coordinates in the other raster of a point of this plane projected along
+    // normal of this plane onto the other plane - an affine function of 2D coordinates
+    auto toOtherCell = [&](double x, double y){
+        Eigen::Vector3d pt = origin + x * xAxis + y * yAxis;
+        Eigen::Vector3d ptProj = pt + ((otherOrigin - pt).dot(otherNormal) / cosAng) * plNormal;
+        Eigen::Vector2d pt2d((ptProj - otherOrigin).dot(otherXAxis),
+                             (ptProj - otherOrigin).dot(otherYAxis));
+        return Eigen::Vector2d((pt2d - otherRaster->origin) / otherRaster->cellSize);
+    };
+    double cell = curRaster->cellSize;
+    Eigen::Vector2d cellStart = toOtherCell(curRaster->origin.x() + 0.5 * cell,
+                                            curRaster->origin.y() + 0.5 * cell);
+    Eigen::Vector2d cellDx = toOtherCell(curRaster->origin.x() + 1.5 * cell,
+                                         curRaster->origin.y() + 0.5 * cell) - cellStart;
+    Eigen::Vector2d cellDy = toOtherCell(curRaster->origin.x() + 0.5 * cell,
+                                         curRaster->origin.y() + 1.5 * cell) - cellStart;
+    
+    long long cnt = 0;
+    for(int r = 0; r < curRaster->rows; ++r){
+        const uint64_t *row = &curRaster->cells[r * curRaster->rowWords];
+        Eigen::Vector2d rowStart = cellStart + r * cellDy;
+        for(int w = 0; w < curRaster->rowWords; ++w){
+            uint64_t word = row[w];
+            if(word == 0){
+                continue;
+            }
+            // resample the other raster only at occupied cells of this word,
+            // so the bits of otherWord are common cells
+            uint64_t otherWord = 0;
+            for(uint64_t bits = word; bits; bits &= bits - 1){
+                int b = __builtin_ctzll(bits);
+                Eigen::Vector2d cellPt = rowStart + (w * 64 + b) * cellDx;
+                int oc = (int)floor(cellPt.x());
+                int orow = (int)floor(cellPt.y());
+                if(oc >= 0 && oc < otherRaster->cols && orow >= 0 && orow < otherRaster->rows){
+                    otherWord |= ((otherRaster->cells[orow * otherRaster->rowWords + oc / 64] >> (oc % 64)) & 1) << b;
+                }
+            }
+            cnt += __builtin_popcountll(otherWord);
+        }
+    }
+    
+    return cnt * cell * cell;
+}
+
 Eigen::Vector3d ConcaveHull::point2dTo3d(const ConcaveHull::Point_2 &point2d) const {
     return origin + CGAL::to_double(point2d.x()) * xAxis + CGAL::to_double(point2d.y()) * yAxis;
 }
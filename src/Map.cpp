@@ -73,7 +73,16 @@ bool operator<(const PendingMatchKey &lhs, const PendingMatchKey &rhs) {
 }
 
 Map::Map()
-    : originalPointCloud(new pcl::PointCloud<pcl::PointXYZRGB>())
+    : Map(MergeParams())
+{}
+
+Map::Map(const MergeParams &imergeParams)
+    : originalPointCloud(new pcl::PointCloud<pcl::PointXYZRGB>()),
+      mergeParams(imergeParams),
+      // normals of merged objects differ by at most 45 deg, as in ObjInstance::isMatching
+      grid(imergeParams.gridCellSize,
+           imergeParams.gridMargin,
+           0.707)
 {
     settings.eolObjInstInit = 4;
     settings.eolObjInstIncr = 2;
@@ -86,18 +95,8 @@ Map::Map()
 }
 
 Map::Map(const cv::FileStorage& fs)
-    :
-    originalPointCloud(new pcl::PointCloud<pcl::PointXYZRGB>())
+    : Map(readMergeParams(fs))
 {
-    settings.eolObjInstInit = 4;
-    settings.eolObjInstIncr = 2;
-    settings.eolObjInstDecr = 1;
-    settings.eolObjInstThresh = 8;
-    settings.eolPendingInit = 4;
-    settings.eolPendingIncr = 2;
-    settings.eolPendingDecr = 1;
-    settings.eolPendingThresh = 6;
-    
 	if((int)fs["map"]["readFromFile"]){
 		pcl::visualization::PCLVisualizer::Ptr viewer(new pcl::visualization::PCLVisualizer("map 3D Viewer"));
 
@@ -107,29 +106,49 @@ Map::Map(const cv::FileStorage& fs)
 		viewer->createViewPort(0.5, 0.0, 1.0, 1.0, v2);
 		viewer->addCoordinateSystem();
 
-		vector<cv::String> mapFilepaths;
-        fs["map"]["mapFiles"] >> mapFilepaths;
+        if((int)fs["map"]["shardMapFiles"]){
+            // every file is matched as a separate shard with its own index,
+            // so objects are neither merged nor indexed here
+            shards = readShards(fs);
+            for(vectorObjInstance &shard : shards){
+                addObjs(shard.begin(), shard.end());
+            }
+            
+            cout << "object instances in map: " << objInstances.size() << endl;
+        }
+        else {
+            vector<cv::String> mapFilepaths;
+            fs["map"]["mapFiles"] >> mapFilepaths;
 
-        static constexpr int idShift = 10000000;
-        for(int f = 0; f < mapFilepaths.size(); ++f) {
-            Map curMap;
+            for(int f = 0; f < mapFilepaths.size(); ++f) {
+                Map curMap;
         
-            std::ifstream ifs(mapFilepaths[f].c_str());
-            boost::archive::text_iarchive ia(ifs);
-            ia >> curMap;
+                std::ifstream ifs(mapFilepaths[f].c_str());
+                boost::archive::text_iarchive ia(ifs);
+                ia >> curMap;
             
-            curMap.shiftIds((f + 1)*idShift);
+                curMap.shiftIds((f + 1)*fileIdShift);
             
-            vectorObjInstance curObjInstances;
-            for(ObjInstance &obj : curMap){
-                curObjInstances.push_back(obj);
-            }
-            mergeNewObjInstances(curObjInstances);
+                vectorObjInstance curObjInstances;
+                for(const ObjInstance &obj : curMap){
+                    curObjInstances.push_back(obj);
+                }
+                mergeNewObjInstances(curObjInstances);
     
-            clearPending();
-        }
+                clearPending();
+            }
 
-        cout << "object instances in map: " << objInstances.size() << endl;
+            cout << "object instances in map: " << objInstances.size() << endl;
+        
+            {
+                ThreadPool threadPool((int)fs["matching"]["numThreads"]);
+                // index covers the largest distance between planes in a potential set
+                buildIndex((double)fs["matching"]["planeDistThresh"],
+                           (double)fs["map"]["indexAngBinSize"],
+                           (double)fs["map"]["indexDistBinSize"],
+                           threadPool);
+            }
+        }
 
         if(viewer) {
             viewer->removeAllPointClouds(v1);
@@ -156,9 +175,44 @@ Map::Map(const cv::FileStorage& fs)
 	}
 }
 
+Map::MergeParams Map::readMergeParams(const cv::FileStorage &fs) {
+    MergeParams mergeParams;
+    mergeParams.hullIntersect = ConcaveHull::readIntersectParams(fs["matching"]);
+    mergeParams.gridCellSize = (double)fs["map"]["mergeGridCellSize"];
+    mergeParams.gridMargin = (double)fs["map"]["mergeGridMargin"];
+    return mergeParams;
+}
+
+std::vector<vectorObjInstance> Map::readShards(const cv::FileStorage &fs) {
+    vector<cv::String> mapFilepaths;
+    fs["map"]["mapFiles"] >> mapFilepaths;
+    
+    vector<vectorObjInstance> shards;
+    for(int f = 0; f < mapFilepaths.size(); ++f) {
+        Map curMap;
+        
+        std::ifstream ifs(mapFilepaths[f].c_str());
+        boost::archive::text_iarchive ia(ifs);
+        ia >> curMap;
+        
+        curMap.shiftIds((f + 1)*fileIdShift);
+        
+        shards.emplace_back();
+        for(const ObjInstance &obj : curMap){
+            shards.back().push_back(obj);
+        }
+        cout << "object instances in shard " << f << ": " << shards.back().size() << endl;
+    }
+    
+    return shards;
+}
+
 void Map::addObj(ObjInstance &obj) {
+    index = MapIndex();
+    
     objInstances.push_back(obj);
     objInstIdToIter[obj.getId()] = --(objInstances.end());
+    grid.insert(obj);
 }
 
 void Map::addObjs(vectorObjInstance::iterator beg, vectorObjInstance::iterator end) {
@@ -180,6 +234,8 @@ void Map::mergeNewObjInstances(vectorObjInstance &newObjInstances,
     
     chrono::high_resolution_clock::time_point startTime = chrono::high_resolution_clock::now();
     
+    index = MapIndex();
+    
     if(viewer){
         viewer->removeAllPointClouds();
         viewer->removeAllShapes();
@@ -250,8 +306,12 @@ void Map::mergeNewObjInstances(vectorObjInstance &newObjInstances,
         }
         
         vector<list<ObjInstance>::iterator> matches;
-        int pl = 0;
-        for(auto it = objInstances.begin(); it != objInstances.end(); ++it, ++pl) {
+        // only objects in the vicinity with a similar orientation can match
+        vector<int> candIds = grid.getCandidates(newObj);
+        for(int candId : candIds) {
+            auto it = objInstIdToIter.at(candId);
+            // position in the list names the point cloud in the viewer
+            int pl = viewer ? distance(objInstances.begin(), it) : 0;
 //            cout << "pl = " << pl << endl;
             ObjInstance &mapObj = *it;
     
@@ -267,7 +327,8 @@ void Map::mergeNewObjInstances(vectorObjInstance &newObjInstances,
         
                 }
     
-                if (mapObj.isMatching(newObj/*,
+                if (mapObj.isMatching(newObj,
+                                      mergeParams.hullIntersect/*,
                                  viewer,
                                  viewPort1,
                                  viewPort2*/)) {
@@ -312,6 +373,7 @@ void Map::mergeNewObjInstances(vectorObjInstance &newObjInstances,
             ObjInstance &mapObj = *matches.front();
             mapObj.merge(newObj);
             mapObj.increaseEolCnt(settings.eolObjInstIncr);
+            grid.update(mapObj);
         }
         else{
             set<int> matchedIds;
@@ -378,6 +440,8 @@ void Map::mergeMapObjInstances(pcl::visualization::PCLVisualizer::Ptr viewer,
 {
     chrono::high_resolution_clock::time_point startTime = chrono::high_resolution_clock::now();
     
+    index = MapIndex();
+    
     if(viewer) {
         for (auto it = objInstances.begin(); it != objInstances.end(); ++it) {
             it->display(viewer, viewPort1);
@@ -395,13 +459,19 @@ void Map::mergeMapObjInstances(pcl::visualization::PCLVisualizer::Ptr viewer,
     UnionFind ufSets(idx);
     for(auto it = objInstances.begin(); it != objInstances.end(); ++it) {
         ObjInstance &mapObj1 = *it;
+        int idx1 = idToIdx.at(mapObj1.getId());
         
-        auto it2 = it;
-        ++it2;
-        for( ; it2 != objInstances.end(); ++it2){
-            ObjInstance &mapObj2 = *it2;
+        // only objects in the vicinity with a similar orientation can match
+        vector<int> candIds = grid.getCandidates(mapObj1);
+        for(int candId : candIds){
+            int idx2 = idToIdx.at(candId);
+            // every pair is checked once, in the order of the list
+            if(idx2 <= idx1){
+                continue;
+            }
+            ObjInstance &mapObj2 = *itrs[idx2];
             
-            if(mapObj1.isMatching(mapObj2)){
+            if(mapObj1.isMatching(mapObj2, mergeParams.hullIntersect)){
                 ufSets.unionSets(idToIdx[mapObj1.getId()], idToIdx[mapObj2.getId()]);
             }
         }
@@ -437,8 +507,12 @@ void Map::mergeMapObjInstances(pcl::visualization::PCLVisualizer::Ptr viewer,
             mergeIt->increaseEolCnt(settings.eolObjInstIncr);
     
             objInstIdToIter.erase((*iti)->getId());
+            grid.remove((*iti)->getId());
             objInstances.erase(*iti);
         }
+        if(mapObjIts.size() > 1){
+            grid.update(*mergeIt);
+        }
         
         it = range.second;
     }
@@ -526,6 +600,8 @@ std::vector<PendingMatchKey> Map::getPendingMatches(int eolThresh) {
 
 
 void Map::executePendingMatches(int eolThresh) {
+    index = MapIndex();
+    
     map<int, int> idToIdx;
     map<int, int> idxToId;
     vector<list<ObjInstance>::iterator> its;
@@ -609,6 +685,7 @@ void Map::executePendingMatches(int eolThresh) {
             mergeIt->increaseEolCnt(settings.eolObjInstIncr);
             
             objInstIdToIter.erase((*iti)->getId());
+            grid.remove((*iti)->getId());
             objInstances.erase(*iti);
         }
         // merge all pending objects
@@ -619,6 +696,7 @@ void Map::executePendingMatches(int eolThresh) {
             pendingIdToIter.erase((*iti)->getId());
             pendingObjInstances.erase(*iti);
         }
+        grid.update(*mergeIt);
         
         it = range.second;
     }
@@ -649,9 +727,12 @@ void Map::decreaseObjEol(int eolSub) {
 }
 
 void Map::removeObjsEol() {
+    index = MapIndex();
+    
     for(auto it = objInstances.begin(); it != objInstances.end(); ){
         if(it->getEolCnt() <= 0){
             objInstIdToIter.erase(it->getId());
+            grid.remove(it->getId());
             it = objInstances.erase(it);
         }
         else{
@@ -662,9 +743,12 @@ void Map::removeObjsEol() {
 
 
 void Map::removeObjsEolThresh(int eolThresh) {
+    index = MapIndex();
+    
     for(auto it = objInstances.begin(); it != objInstances.end(); ){
         if(it->getEolCnt() < eolThresh){
             objInstIdToIter.erase(it->getId());
+            grid.remove(it->getId());
             it = objInstances.erase(it);
         }
         else{
@@ -674,9 +758,12 @@ void Map::removeObjsEolThresh(int eolThresh) {
 }
 
 void Map::removeObjsObsThresh(int obsThresh) {
+    index = MapIndex();
+    
     for(auto it = objInstances.begin(); it != objInstances.end(); ){
         if(it->getObsCnt() < obsThresh){
             objInstIdToIter.erase(it->getId());
+            grid.remove(it->getId());
             it = objInstances.erase(it);
         }
         else{
@@ -686,6 +773,8 @@ void Map::removeObjsObsThresh(int obsThresh) {
 }
 
 void Map::shiftIds(int startId) {
+    index = MapIndex();
+    
 //    map<int, int> oldIdToNewId;
     for(auto it = objInstances.begin(); it != objInstances.end(); ++it){
         int oldId = it->getId();
@@ -707,6 +796,8 @@ void Map::shiftIds(int startId) {
         it->setId(newId);
 //        oldIdToNewId[oldId] = newId;
     }
+    
+    rebuildGrid();
  
     // for now just clearing pending objects
     clearPending();
@@ -750,11 +841,8 @@ std::map<int, int> Map::getVisibleObjs(Vector7d pose,
         viewer->addCoordinateSystem(0.5, trans, "camera_coord");
     }
     
-    vector<vector<vector<pair<double, int>>>> projPlanes(rows,
-                                                         vector<vector<pair<double, int>>>(cols,
-                                                                       vector<pair<double, int>>()));
+    zBuffer.reset(rows, cols, cameraMatrix);
     
-    cv::Mat projPoly(rows, cols, CV_8UC1);
     for(auto it = objInstances.begin(); it != objInstances.end(); ++it) {
 //        cout << "id = " << it->getId() << endl;
     
@@ -781,8 +869,7 @@ std::map<int, int> Map::getVisibleObjs(Vector7d pose,
 //                                                       cameraMatrix,
 //                                                       planeEqCamera);
 
-            vector<cv::Point *> polyCont;
-            vector<int> polyContNpts;
+            vector<vectorVector2d> polys;
         
             ConcaveHull hull = it->getHull().transform(poseSE3Quat.inverse().toVector());
         
@@ -802,8 +889,7 @@ std::map<int, int> Map::getVisibleObjs(Vector7d pose,
             const std::vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> &polygons3d = hullClip.getPolygons3d();
 //            cout << "polygons3d.size() = " << polygons3d.size() << endl;
             for (pcl::PointCloud<pcl::PointXYZRGB>::Ptr poly3d : polygons3d) {
-                polyCont.push_back(new cv::Point[poly3d->size()]);
-                polyContNpts.push_back(poly3d->size());
+                vectorVector2d poly;
 
 //                pcl::PointCloud<pcl::PointXYZRGB>::Ptr poly3dPose(new pcl::PointCloud<pcl::PointXYZRGB>());
 //                // transform to camera frame
@@ -818,60 +904,24 @@ std::map<int, int> Map::getVisibleObjs(Vector7d pose,
                 
                 int corrPointCnt = 0;
                 for (int pt = 0; pt < pointsReproj.cols; ++pt) {
-                    int u = std::round(pointsReproj.at<cv::Vec3f>(pt)[0]);
-                    int v = std::round(pointsReproj.at<cv::Vec3f>(pt)[1]);
+                    float u = pointsReproj.at<cv::Vec3f>(pt)[0];
+                    float v = pointsReproj.at<cv::Vec3f>(pt)[1];
                     float d = pointsReproj.at<cv::Vec3f>(pt)[2];
+                    int ur = std::round(u);
+                    int vr = std::round(v);
                 
-                    if (u >= 0 && u < cols && v >= 0 && v < rows && d > 0) {
+                    if (ur >= 0 && ur < cols && vr >= 0 && vr < rows && d > 0) {
                         ++corrPointCnt;
                     }
-                    polyCont.back()[pt] = cv::Point(u, v);
+                    poly.push_back(Eigen::Vector2d(u, v));
                 }
 //                cout << "corrPointCnt = " << corrPointCnt << endl;
-                if (corrPointCnt == 0) {
-                    delete[] polyCont.back();
-                    polyCont.erase(polyCont.end() - 1);
-                    polyContNpts.erase(polyContNpts.end() - 1);
+                if (corrPointCnt > 0) {
+                    polys.push_back(poly);
                 }
             }
-            if (polyCont.size() > 0) {
-                projPoly.setTo(0);
-                
-                cv::fillPoly(projPoly,
-                             (const cv::Point **) polyCont.data(),
-                             polyContNpts.data(),
-                             polyCont.size(),
-                             cv::Scalar(255));
-            
-                if (viewer) {
-                    cv::imshow("proj_poly", projPoly);
-                }
-            
-                vectorVector2d polyImagePts;
-                for (int r = 0; r < rows; ++r) {
-                    for (int c = 0; c < cols; ++c) {
-                        if (projPoly.at<uint8_t>(r, c) > 0) {
-                            polyImagePts.push_back((Eigen::Vector2d() << c, r).finished());
-                        }
-                    }
-                }
-                vectorVector3d polyPlanePts;
-                Misc::projectImagePointsOntoPlane(polyImagePts,
-                                                  polyPlanePts,
-                                                  cameraMatrix,
-                                                  planeEqCamera);
-                for (int pt = 0; pt < polyImagePts.size(); ++pt) {
-                    int x = std::round(polyImagePts[pt](0));
-                    int y = std::round(polyImagePts[pt](1));
-                    // depth is z coordinate
-                    double d = polyPlanePts[pt](2);
-                
-                    projPlanes[y][x].push_back(make_pair(d, it->getId()));
-                }
-            }
-        
-            for (int p = 0; p < polyCont.size(); ++p) {
-                delete[] polyCont[p];
+            if (polys.size() > 0) {
+                zBuffer.addObj(it->getId(), polys, planeEqCamera);
             }
         
             if (viewer) {
@@ -904,24 +954,8 @@ std::map<int, int> Map::getVisibleObjs(Vector7d pose,
         idToCnt[it->getId()] = 0;
     }
     
-    for(int r = 0; r < rows; ++r) {
-        for (int c = 0; c < cols; ++c) {
-            vector<pair<double, int>> &curPlanes = projPlanes[r][c];
-            sort(curPlanes.begin(), curPlanes.end());
-            
-            if(!curPlanes.empty()){
-                double minD = curPlanes.front().first;
-                
-                for(const pair<double, int> &curPair : curPlanes){
-                    if(abs(minD - curPair.first) < 0.2 && curPair.first < 4.0){
-                        int id = curPair.second;
-                        
-                        idToCnt.at(id) += 1;
-                    }
-                }
-            }
-        }
-    }
+    // pixels not farther than 0.2 m from the nearest surface and nearer than 4 m
+    zBuffer.countVisible(0.2, 4.0, idToCnt);
 //    for(const pair<int, int> &curCnt : idToCnt){
 //        cout << "curCnt " << curCnt.first << " = " << curCnt.second << endl;
 //    }
@@ -945,6 +979,31 @@ std::map<int, int> Map::getVisibleObjs(Vector7d pose,
     return idToCnt;
 }
 
+void Map::buildIndex(double maxDist,
+                     double angBinSize,
+                     double distBinSize,
+                     ThreadPool &threadPool)
+{
+    chrono::high_resolution_clock::time_point startTime = chrono::high_resolution_clock::now();
+    
+    vectorObjInstance objInstancesVec(objInstances.begin(), objInstances.end());
+    index.build(objInstancesVec,
+                maxDist,
+                angBinSize,
+                distBinSize,
+                threadPool);
+    
+    chrono::high_resolution_clock::time_point endTime = chrono::high_resolution_clock::now();
+    
+    cout << "Map index build time: " << chrono::duration_cast<chrono::milliseconds>(endTime - startTime).count() << endl;
+}
+
+void Map::buildIndexCaches() {
+    if(index.isBuilt()){
+        index.buildCaches(objInstances.begin(), objInstances.end());
+    }
+}
+
 pcl::PointCloud<pcl::PointXYZL>::Ptr Map::getLabeledPointCloud()
 {
     pcl::PointCloud<pcl::PointXYZL>::Ptr pcLab(new pcl::PointCloud<pcl::PointXYZL>());
@@ -973,6 +1032,13 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr Map::getColorPointCloud()
     return pcCol;
 }
 
+void Map::rebuildGrid() {
+    grid.clear();
+    for(const ObjInstance &obj : objInstances){
+        grid.insert(obj);
+    }
+}
+
 void Map::recalculateIdToIter() {
     for(auto it = objInstances.begin(); it != objInstances.end(); ++it){
         objInstIdToIter[it->getId()] = it;
@@ -0,0 +1,206 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "MapIndex.hpp"
+#include "Misc.hpp"
+
+using namespace std;
+
+MapIndex::MapIndex()
+    : built(false),
+      maxDist(0.0),
+      angBinSize(1.0),
+      distBinSize(1.0),
+      numAngBins(0),
+      numDistBins(0)
+{}
+
+MapIndex::MapIndex(const vectorObjInstance &objInstances,
+                   double maxDist,
+                   double angBinSize,
+                   double distBinSize,
+                   ThreadPool &threadPool)
+{
+    build(objInstances,
+          maxDist,
+          angBinSize,
+          distBinSize,
+          threadPool);
+}
+
+void MapIndex::build(const vectorObjInstance &objInstances,
+                     double imaxDist,
+                     double iangBinSize,
+                     double idistBinSize,
+                     ThreadPool &threadPool)
+{
+    maxDist = imaxDist;
+    angBinSize = iangBinSize;
+    distBinSize = idistBinSize;
+    numAngBins = (int)ceil(pi / angBinSize) + 1;
+    numDistBins = (int)ceil(maxDist / distBinSize) + 1;
+    
+    ids.clear();
+    for(const ObjInstance &obj : objInstances){
+        ids.push_back(obj.getId());
+    }
+    
+    int numObjs = objInstances.size();
+    neighbors.assign(numObjs, vector<Neighbor>());
+    // every row computes distances to objects with larger indices
+    threadPool.parallelFor(numObjs, threadPool.chooseChunkSize(numObjs), [&](int c, int oBeg, int oEnd){
+        for(int o1 = oBeg; o1 < oEnd; ++o1){
+            for(int o2 = o1 + 1; o2 < numObjs; ++o2){
+                double dist = objInstances[o1].getHull().minDistance(objInstances[o2].getHull());
+                if(dist <= maxDist){
+                    double ang = compNormalAngle(objInstances[o1], objInstances[o2]);
+                    neighbors[o1].push_back(Neighbor{o2, dist, ang});
+                }
+            }
+        }
+    });
+    
+    pairBuckets.assign(numAngBins * numDistBins, vector<pair<int, int>>());
+    // fill lower triangle and buckets serially, so the order does not depend on threads
+    for(int o1 = 0; o1 < numObjs; ++o1){
+        for(const Neighbor &nh : neighbors[o1]){
+            if(nh.idx > o1){
+                neighbors[nh.idx].push_back(Neighbor{o1, nh.dist, nh.ang});
+                pairBuckets[getAngBin(nh.ang) * numDistBins + getDistBin(nh.dist)].emplace_back(o1, nh.idx);
+            }
+        }
+    }
+    for(vector<Neighbor> &curNeighbors : neighbors){
+        sort(curNeighbors.begin(), curNeighbors.end(),
+             [](const Neighbor &lhs, const Neighbor &rhs){ return lhs.idx < rhs.idx; });
+    }
+    
+    buildCaches(objInstances.begin(), objInstances.end());
+    
+    built = true;
+}
+
+bool MapIndex::isValidFor(const vectorObjInstance &objInstances) const {
+    if(!built || objInstances.size() != ids.size()){
+        return false;
+    }
+    for(int o = 0; o < objInstances.size(); ++o){
+        if(objInstances[o].getId() != ids[o]){
+            return false;
+        }
+    }
+    return true;
+}
+
+const MapIndex::Neighbor *MapIndex::findNeighbor(int idx1, int idx2) const {
+    const vector<Neighbor> &curNeighbors = neighbors[idx1];
+    auto it = lower_bound(curNeighbors.begin(), curNeighbors.end(), idx2,
+                          [](const Neighbor &lhs, int rhs){ return lhs.idx < rhs; });
+    if(it != curNeighbors.end() && it->idx == idx2){
+        return &(*it);
+    }
+    return nullptr;
+}
+
+void MapIndex::findPairs(double ang,
+                         double angThresh,
+                         double distThresh,
+                         std::vector<std::pair<int, int>> &pairs) const
+{
+    int angBinBeg = getAngBin(ang - angThresh);
+    int angBinEnd = getAngBin(ang + angThresh);
+    int distBinEnd = getDistBin(distThresh);
+    for(int ab = angBinBeg; ab <= angBinEnd; ++ab){
+        for(int db = 0; db <= distBinEnd; ++db){
+            for(const pair<int, int> &curPair : pairBuckets[ab * numDistBins + db]){
+                // border bins contain also pairs outside of the range
+                if(ab == angBinBeg || ab == angBinEnd || db == distBinEnd){
+                    const Neighbor *nh = findNeighbor(curPair.first, curPair.second);
+                    if(fabs(nh->ang - ang) > angThresh || nh->dist > distThresh){
+                        continue;
+                    }
+                }
+                pairs.push_back(curPair);
+            }
+        }
+    }
+}
+
+size_t MapIndex::countPairs(double ang, double angThresh) const {
+    int angBinBeg = getAngBin(ang - angThresh);
+    int angBinEnd = getAngBin(ang + angThresh);
+    size_t cnt = 0;
+    for(int ab = angBinBeg; ab <= angBinEnd; ++ab){
+        for(int db = 0; db < numDistBins; ++db){
+            cnt += pairBuckets[ab * numDistBins + db].size();
+        }
+    }
+    return cnt;
+}
+
+double MapIndex::compNormalAngle(const ObjInstance &obj1, const ObjInstance &obj2) {
+    Eigen::Vector3d n1 = obj1.getNormal().head<3>().normalized();
+    Eigen::Vector3d n2 = obj2.getNormal().head<3>().normalized();
+    // clamped, so nearly parallel normals do not produce NaN
+    return acos(max(-1.0, min(1.0, n1.dot(n2))));
+}
+
+int MapIndex::getAngBin(double ang) const {
+    return max(0, min(numAngBins - 1, (int)floor(ang / angBinSize)));
+}
+
+int MapIndex::getDistBin(double dist) const {
+    return max(0, min(numDistBins - 1, (int)floor(dist / distBinSize)));
+}
+
+void MapIndex::findCandidates(const ObjInstance::Descriptor &desc,
+                              const ObjInstance::DescriptorThresh &thresh,
+                              std::vector<int> &candidates) const
+{
+    candidates.clear();
+    if(!descIndex){
+        return;
+    }
+    
+    // L1 distance of coarse histograms is the last test of the cascade and the only one
+    // that can be answered by the tree
+    Eigen::Matrix<float, ObjInstance::coarseHistBins, 1> queryData = desc.coarseHist;
+    flann::Matrix<float> query(queryData.data(), 1, ObjInstance::coarseHistBins);
+    vector<vector<int>> indices;
+    vector<vector<float>> dists;
+    descIndex->radiusSearch(query,
+                            indices,
+                            dists,
+                            thresh.maxHistDist,
+                            flann::SearchParams(flann::FLANN_CHECKS_UNLIMITED));
+    
+    for(int idx : indices[0]){
+        if(ObjInstance::checkDescriptors(desc, descs[idx], thresh)){
+            candidates.push_back(idx);
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+}
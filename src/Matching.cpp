@@ -26,6 +26,8 @@
 #include <chrono>
 #include <thread>
 #include <tuple>
+#include <atomic>
+#include <limits>
 
 #include <opencv2/opencv.hpp>
 
@@ -40,6 +42,9 @@
 
 #include "Matching.hpp"
 #include "Misc.hpp"
+#include "ProbDist.hpp"
+#include "VoteAccum.hpp"
+#include "MatchingCache.hpp"
 
 using namespace std;
 
@@ -47,33 +52,308 @@ using namespace std;
 //
 //}
 
-Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
+Matching::Settings::Settings()
+    : planeAppThresh(0.0),
+      lineAppThresh(0.0),
+      lineToLineAngThresh(0.0),
+      planeToPlaneAngThresh(0.0),
+      planeToLineAngThresh(0.0),
+      planeDistThresh(0.0),
+      scoreThresh(0.0),
+      sinValsThresh(0.0),
+      planeEqDiffThresh(0.0),
+      intAreaThresh(0.0),
+      lineEqDiffThresh(0.0),
+      intLenThresh(0.0),
+      maxLineSubsetSize(0),
+      maxPotMatches(0),
+      numThreads(0),
+      kernelMaxExp(20.0),
+      aggregator("kernels"),
+      voteTransCellSize(0.0),
+      voteRotCellSize(0.0),
+      voteNumPeaks(0),
+      voteRefine(false),
+      temporalRotStd(0.0),
+      temporalTransStd(0.0),
+      temporalProbRatio(0.0),
+      indexAngBinSize(0.0),
+      indexDistBinSize(0.0)
+{
+    descThresh.maxAreaRatio = 0.0;
+    descThresh.maxExtRatio = 0.0;
+    descThresh.maxCurvDiff = 0.0;
+    descThresh.maxHistDist = 0.0;
+}
+
+Matching::Settings::Settings(const cv::FileStorage &fs) {
+    planeAppThresh = (double)fs["matching"]["planeAppThresh"];
+    lineAppThresh = (double)fs["matching"]["lineAppThresh"];
+    
+    lineToLineAngThresh = (double)fs["matching"]["lineToLineAngThresh"];
+    planeToPlaneAngThresh = (double)fs["matching"]["planeToPlaneAngThresh"];
+    planeToLineAngThresh = (double)fs["matching"]["planeToLineAngThresh"];
+    planeDistThresh = (double)fs["matching"]["planeDistThresh"];
+    
+    scoreThresh = (double)fs["matching"]["scoreThresh"];
+    sinValsThresh = (double)fs["matching"]["sinValsThresh"];
+    planeEqDiffThresh = (double)fs["matching"]["planeEqDiffThresh"];
+    intAreaThresh = (double)fs["matching"]["intAreaThresh"];
+    lineEqDiffThresh = (double)fs["matching"]["lineEqDiffThresh"];
+    intLenThresh = (double)fs["matching"]["intLenThresh"];
+    maxLineSubsetSize = (int)fs["matching"]["maxLineSubsetSize"];
+    maxPotMatches = (int)fs["matching"]["maxPotMatches"];
+    numThreads = (int)fs["matching"]["numThreads"];
+    kernelMaxExp = (double)fs["matching"]["kernelMaxExp"];
+    aggregator = (string)fs["matching"]["aggregator"];
+    voteTransCellSize = (double)fs["matching"]["voteTransCellSize"];
+    voteRotCellSize = (double)fs["matching"]["voteRotCellSize"];
+    voteNumPeaks = (int)fs["matching"]["voteNumPeaks"];
+    voteRefine = (int)fs["matching"]["voteRefine"];
+    descThresh.maxAreaRatio = (double)fs["matching"]["descMaxAreaRatio"];
+    descThresh.maxExtRatio = (double)fs["matching"]["descMaxExtRatio"];
+    descThresh.maxCurvDiff = (double)fs["matching"]["descMaxCurvDiff"];
+    descThresh.maxHistDist = planeAppThresh;
+    sprtParams.enabled = (int)fs["matching"]["sprtEnabled"];
+    sprtParams.pCorrect = (double)fs["matching"]["sprtPCorrect"];
+    sprtParams.pWrong = (double)fs["matching"]["sprtPWrong"];
+    sprtParams.falseRejRate = (double)fs["matching"]["sprtFalseRejRate"];
+    sprtParams.falseAccRate = (double)fs["matching"]["sprtFalseAccRate"];
+    sprtParams.angThresh = (double)fs["matching"]["sprtAngThresh"];
+    sprtParams.distThresh = (double)fs["matching"]["sprtDistThresh"];
+    temporalRotStd = (double)fs["matching"]["temporalRotStd"];
+    temporalTransStd = (double)fs["matching"]["temporalTransStd"];
+    temporalProbRatio = (double)fs["matching"]["temporalProbRatio"];
+    hullIntersect = ConcaveHull::readIntersectParams(fs["matching"]);
+    indexAngBinSize = (double)fs["map"]["indexAngBinSize"];
+    indexDistBinSize = (double)fs["map"]["indexDistBinSize"];
+}
+
+Matching::Stats::Stats()
+    : numCalls(0),
+      appTime(chrono::milliseconds::zero()),
+      tripletsTime(chrono::milliseconds::zero()),
+      transformTime(chrono::milliseconds::zero()),
+      scoreTime(chrono::milliseconds::zero()),
+      fitTime(chrono::milliseconds::zero()),
+      triTransTimeSum(0.0),
+      triTransTimeSqSum(0.0),
+      maxTriTransTime(0.0)
+{}
+
+Matching::Stats &Matching::Stats::operator+=(const Stats &other) {
+    numCalls += other.numCalls;
+    appTime += other.appTime;
+    tripletsTime += other.tripletsTime;
+    transformTime += other.transformTime;
+    scoreTime += other.scoreTime;
+    fitTime += other.fitTime;
+    triTransTimeSum += other.triTransTimeSum;
+    triTransTimeSqSum += other.triTransTimeSqSum;
+    maxTriTransTime = max(maxTriTransTime, other.maxTriTransTime);
+    verifStats += other.verifStats;
+    return *this;
+}
+
+void Matching::Stats::print() const {
+    if(numCalls == 0){
+        return;
+    }
+    if(numCalls > 1) {
+        double mean = triTransTimeSum / numCalls;
+        double var = max((triTransTimeSqSum - numCalls * mean * mean) / (numCalls - 1), 0.0);
+        cout << "triplets + transform std dev = " << sqrt(var) << endl;
+        cout << "triplets + transform max = " << maxTriTransTime << endl;
+    }
+    
+    cout << "Mean matching app time: " << (appTime.count() / numCalls) << endl;
+    cout << "Mean matching triplets time: " << (tripletsTime.count() / numCalls) << endl;
+    cout << "Mean matching transform time: " << (transformTime.count() / numCalls) << endl;
+    cout << "Mean matching score time: " << (scoreTime.count() / numCalls) << endl;
+    cout << "Mean matching fit time: " << (fitTime.count() / numCalls) << endl;
+}
+
+Matching::MatchType Matching::matchFrameToMap(const Settings &settings,
+                                              ThreadPool &threadPool,
+                                              Scratch &scratch,
+                                              Stats &stats,
                                               const vectorObjInstance &frameObjInstances,
                                               const vectorObjInstance &mapObjInstances,
-                                              vectorVector7d &bestTrans,
-                                              std::vector<double> &bestTransProbs,
-                                              std::vector<double> &bestTransFits,
-                                              std::vector<int> &bestTransDistinct,
-                                              std::vector<Matching::ValidTransform> &retTransforms,
+                                              const MapIndex *mapIndex,
+                                              const MatchOptions &options,
+                                              MatchResult &result,
                                               pcl::visualization::PCLVisualizer::Ptr viewer,
                                               int viewPort1,
                                               int viewPort2)
 {
-	cout << "Matching::matchFrameToMap" << endl;
-	double planeAppThresh = (double)fs["matching"]["planeAppThresh"];
-    double lineAppThresh = (double)fs["matching"]["lineAppThresh"];
-    
-    double lineToLineAngThresh = (double)fs["matching"]["lineToLineAngThresh"];
-    double planeToPlaneAngThresh = (double)fs["matching"]["planeToPlaneAngThresh"];
-    double planeToLineAngThresh = (double)fs["matching"]["planeToLineAngThresh"];
-    double planeDistThresh = (double)fs["matching"]["planeDistThresh"];
-    
-    double scoreThresh = (double)fs["matching"]["scoreThresh"];
-    double sinValsThresh = (double)fs["matching"]["sinValsThresh"];
-    double planeEqDiffThresh = (double)fs["matching"]["planeEqDiffThresh"];
-    double intAreaThresh = (double)fs["matching"]["intAreaThresh"];
-    double lineEqDiffThresh = (double)fs["matching"]["lineEqDiffThresh"];
-    double intLenThresh = (double)fs["matching"]["intLenThresh"];
+    return matchFrameToShards(settings,
+                              threadPool,
+                              scratch,
+                              stats,
+                              frameObjInstances,
+                              vector<MapShard>{MapShard(&mapObjInstances, mapIndex)},
+                              options,
+                              result,
+                              viewer,
+                              viewPort1,
+                              viewPort2);
+}
+
+Matching::MatchType Matching::matchFrameToShards(const Settings &settings,
+                                                 ThreadPool &threadPool,
+                                                 Scratch &scratch,
+                                                 Stats &stats,
+                                                 const vectorObjInstance &frameObjInstances,
+                                                 const std::vector<MapShard> &mapShards,
+                                                 const MatchOptions &options,
+                                                 MatchResult &result,
+                                                 pcl::visualization::PCLVisualizer::Ptr viewer,
+                                                 int viewPort1,
+                                                 int viewPort2)
+{
+    result = MatchResult();
+    if(!options.temporalState){
+        return searchShards(settings,
+                            threadPool,
+                            scratch,
+                            stats,
+                            frameObjInstances,
+                            mapShards,
+                            options.budget,
+                            options.posePrior,
+                            options.cache,
+                            result,
+                            viewer,
+                            viewPort1,
+                            viewPort2);
+    }
+    
+    TemporalState &temporalState = *options.temporalState;
+    MatchType matchType = MatchType::Unknown;
+    // the accumulated map is recreated between calls and gets new versions of its objects,
+    // so results are shared only by the searches of this call
+    MatchingCache localCache;
+    MatchingCache *cache = options.cache ? options.cache : &localCache;
+    
+    if(temporalState.isSet && !temporalState.bestTrans.empty()){
+        double temporalRotStd = settings.temporalRotStd;
+        double temporalTransStd = settings.temporalTransStd;
+        
+        // previous fix moved by the odometry increment
+        g2o::SE3Quat odomIncr = g2o::SE3Quat(temporalState.odomPose).inverse() * g2o::SE3Quat(options.odomPose);
+        Vector7d predPose = (g2o::SE3Quat(temporalState.bestTrans.front()) * odomIncr).toVector();
+        
+        Eigen::Matrix<double, 6, 6> covar = Eigen::Matrix<double, 6, 6>::Zero();
+        covar.block<3, 3>(0, 0) = temporalRotStd * temporalRotStd * Eigen::Matrix3d::Identity();
+        covar.block<3, 3>(3, 3) = temporalTransStd * temporalTransStd * Eigen::Matrix3d::Identity();
+        
+        PosePrior posePrior(predPose, covar);
+        
+        cout << "verifying hypotheses consistent with the previous fix" << endl;
+        matchType = searchShards(settings,
+                                 threadPool,
+                                 scratch,
+                                 stats,
+                                 frameObjInstances,
+                                 mapShards,
+                                 options.budget,
+                                 posePrior,
+                                 cache,
+                                 result,
+                                 viewer,
+                                 viewPort1,
+                                 viewPort2);
+        // the fix is confirmed by a dominating maximum, or by a second maximum
+        // that is also consistent with the prediction
+        bool confirmed = (matchType == MatchType::Ok);
+        if(confirmed && result.bestTrans.size() > 1){
+            bool dominates = result.bestTransProbs[0] >= settings.temporalProbRatio * result.bestTransProbs[1];
+            bool secondInPrior = checkPosePrior(result.bestTrans[1], posePrior);
+            confirmed = dominates || secondInPrior;
+        }
+        if(!confirmed){
+            cout << "previous fix not confirmed, running full search" << endl;
+            matchType = MatchType::Unknown;
+            result = MatchResult();
+        }
+    }
+    
+    if(matchType != MatchType::Ok){
+        matchType = searchShards(settings,
+                                 threadPool,
+                                 scratch,
+                                 stats,
+                                 frameObjInstances,
+                                 mapShards,
+                                 options.budget,
+                                 PosePrior(),
+                                 cache,
+                                 result,
+                                 viewer,
+                                 viewPort1,
+                                 viewPort2);
+    }
+    
+    if(matchType == MatchType::Ok){
+        temporalState.isSet = true;
+        temporalState.bestTrans = result.bestTrans;
+        temporalState.odomPose = options.odomPose;
+    }
+    else{
+        temporalState.reset();
+    }
+    
+    return matchType;
+}
+
+std::vector<Matching::ValidTransform> Matching::generateTransforms(const Settings &settings,
+                                                                 ThreadPool &threadPool,
+                                                                 Stats &stats,
+                                                                 const vectorObjInstance &frameObjInstances,
+                                                                 const vectorObjInstance &mapObjInstances,
+                                                                 const MapIndex *mapIndex,
+                                                                 const Budget &budget,
+                                                                 const PosePrior &posePrior,
+                                                                 bool &truncated,
+                                                                 VerifStats &verifStats,
+                                                                 MatchingCache *cache,
+                                                                 pcl::visualization::PCLVisualizer::Ptr viewer,
+                                                                 int viewPort1,
+                                                                 int viewPort2)
+{
+	cout << "Matching::generateTransforms" << endl;
+	double planeAppThresh = settings.planeAppThresh;
+    double lineAppThresh = settings.lineAppThresh;
+    
+    double lineToLineAngThresh = settings.lineToLineAngThresh;
+    double planeToPlaneAngThresh = settings.planeToPlaneAngThresh;
+    double planeToLineAngThresh = settings.planeToLineAngThresh;
+    double planeDistThresh = settings.planeDistThresh;
+    
+    double scoreThresh = settings.scoreThresh;
+    double sinValsThresh = settings.sinValsThresh;
+    double planeEqDiffThresh = settings.planeEqDiffThresh;
+    double intAreaThresh = settings.intAreaThresh;
+    double lineEqDiffThresh = settings.lineEqDiffThresh;
+    double intLenThresh = settings.intLenThresh;
+    int maxLineSubsetSize = settings.maxLineSubsetSize;
+    int maxPotMatches = settings.maxPotMatches;
+    const ObjInstance::DescriptorThresh &descThresh = settings.descThresh;
+    const SprtParams &sprtParams = settings.sprtParams;
+    const ConcaveHull::IntersectParams &hullIntersect = settings.hullIntersect;
+    
+    if(cache){
+        // cached potential matches depend on the map and on thresholds of appearance checks
+        cache->prepare(mapObjInstances,
+                       vector<double>{planeAppThresh,
+                                      lineAppThresh,
+                                      lineToLineAngThresh,
+                                      descThresh.maxAreaRatio,
+                                      descThresh.maxExtRatio,
+                                      descThresh.maxCurvDiff,
+                                      (double)maxLineSubsetSize});
+        cache->retain(frameObjInstances);
+    }
 
     double shadingLevel = 1.0/16;
 
@@ -83,10 +363,7 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
 //    curGt << -3.08641, 0.5365, -2.18575, 0.955013, -0.0118122, 0.239884, 0.173972;
 //    g2o::SE3Quat curGtSE3Quat(curGt);
 
-	vector<cv::Mat> frameObjFeats;
-	compObjFeatures(frameObjInstances, frameObjFeats);
-	vector<cv::Mat> mapObjFeats;
-	compObjFeatures(mapObjInstances, mapObjFeats);
+    truncated = false;
 
 	if(viewer){
 		viewer->removeAllPointClouds(viewPort1);
@@ -131,264 +408,573 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
                                                  planeAppThresh,
                                                  lineAppThresh,
                                                  lineToLineAngThresh,
+                                                 descThresh,
+                                                 maxLineSubsetSize,
+                                                 // limited after filtering with the prior
+                                                 posePrior.isSet ? 0 : maxPotMatches,
+                                                 mapIndex,
+                                                 cache,
                                                  viewer,
                                                  viewPort1,
                                                  viewPort2);
     
 
+    if(posePrior.isSet){
+        potMatches = filterPotMatches(potMatches,
+                                      mapObjInstances,
+                                      frameObjInstances,
+                                      posePrior,
+                                      planeToPlaneAngThresh);
+        limitPotMatches(potMatches, maxPotMatches);
+    }
+    
 	cout << "potMatches.size() = " << potMatches.size() << endl;
 
     chrono::high_resolution_clock::time_point endAppTime = chrono::high_resolution_clock::now();
+    
+    // the following stages do nothing without potential matches
+    if(budget.isExpired()){
+        cout << "deadline passed after finding potential matches" << endl;
+        potMatches.clear();
+        truncated = true;
+    }
 
 	cout << "Adding sets" << endl;
-    vector<vector<PotMatch> > potSets = findPotSets(potMatches,
-                                                    mapObjInstances,
-                                                    frameObjInstances,
-                                                    planeDistThresh,
-                                                    lineToLineAngThresh,
-                                                    planeToPlaneAngThresh,
-                                                    planeToLineAngThresh,
-                                                    viewer,
-                                                    viewPort1,
-                                                    viewPort2);
+    vector<PotSetIdxs> potSets = findPotSets(potMatches,
+                                             mapObjInstances,
+                                             frameObjInstances,
+                                             planeDistThresh,
+                                             lineToLineAngThresh,
+                                             planeToPlaneAngThresh,
+                                             planeToLineAngThresh,
+                                             threadPool,
+                                             mapIndex,
+                                             cache,
+                                             viewer,
+                                             viewPort1,
+                                             viewPort2);
     
     chrono::high_resolution_clock::time_point endTripletTime = chrono::high_resolution_clock::now();
+    
+    if(budget.isExpired()){
+        cout << "deadline passed after finding sets" << endl;
+        potSets.clear();
+        truncated = true;
+    }
 
 	cout << "potSets.size() = " << potSets.size() << endl;
+    if(cache){
+        cout << "cache hits = " << cache->getNumHits() << ", misses = " << cache->getNumMisses() << endl;
+    }
 
-	cout << "computing 3D transforms" << endl;
+    if(budget.isLimited()){
+        // the most likely hypotheses first, so that they are verified before the budget runs out
+        vector<pair<double, int>> potSetsAppDiffs;
+        for(int s = 0; s < potSets.size(); ++s){
+            double appDiff = 0.0;
+            for(int p : potSets[s]){
+                appDiff += potMatches[p].planeAppDiff;
+            }
+            potSetsAppDiffs.emplace_back(appDiff, s);
+        }
+        sort(potSetsAppDiffs.begin(), potSetsAppDiffs.end());
+        
+        vector<PotSetIdxs> sortedPotSets;
+        for(const pair<double, int> &appDiff : potSetsAppDiffs){
+            sortedPotSets.push_back(potSets[appDiff.second]);
+        }
+        potSets.swap(sortedPotSets);
+        
+        if(budget.maxEvals > 0 && potSets.size() > budget.maxEvals){
+            potSets.resize(budget.maxEvals);
+            truncated = true;
+        }
+    }
 
-	std::vector<ValidTransform> transforms;
+	cout << "computing 3D transforms" << endl;
 
-	for(int s = 0; s < potSets.size(); ++s){
-//		cout << "s = " << s << endl;
-        
-        vectorVector3d pointsMap;
-        vectorVector4d planesMap;
-        std::vector<Vector6d> linesMap;
-        vectorVector3d pointsFrame;
-        vectorVector4d planesFrame;
-        std::vector<Vector6d> linesFrame;
-
-        for(int ch = 0; ch < potSets[s].size(); ++ch) {
-//            cout << "map " << ch << ": " << mapObjInstances[potSets[s][ch].plane1].getNormal().transpose() << endl;
-            planesMap.push_back(mapObjInstances[potSets[s][ch].plane1].getNormal());
-            const vectorLineSeg &allLinesMap = mapObjInstances[potSets[s][ch].plane1].getLineSegs();
-            for (int lm = 0; lm < potSets[s][ch].lineSegs1.size(); ++lm) {
-                linesMap.push_back(allLinesMap[potSets[s][ch].lineSegs1[lm]].toPointNormalEq());
+    // frame hulls are read by all threads and the lazy kernel computes exact values
+    // on first use, so they have to be computed before the parallel stage
+    for(const ObjInstance &obj : frameObjInstances){
+        obj.getHull().computeExact();
+    }
+    
+    // equations used by SPRT, frame planes with more points are checked first,
+    // as they are more likely to be present in the map
+    vectorVector4d mapPlanes;
+    for(const ObjInstance &obj : mapObjInstances){
+        mapPlanes.push_back(obj.getNormal());
+    }
+    vectorVector4d framePlanes;
+    vector<int> frameOrder;
+    for(int of = 0; of < frameObjInstances.size(); ++of){
+        framePlanes.push_back(frameObjInstances[of].getNormal());
+        frameOrder.push_back(of);
+    }
+    sort(frameOrder.begin(), frameOrder.end(),
+         [&frameObjInstances](int lhs, int rhs){
+             return frameObjInstances[lhs].getPoints()->size() > frameObjInstances[rhs].getPoints()->size();
+         });
+    
+    // sets are handed out through a shared cursor, so they are verified in sorted order
+    // and the ones skipped after the deadline are the least likely ones.
+    // Every worker stores its transforms with indices of sets, sorted after the loop
+    // to get the same result as the serial loop
+    int numWorkers = std::min(threadPool.getNumThreads(), (int)potSets.size());
+    vector<vector<pair<int, ValidTransform>>> workerTransforms(numWorkers);
+    vector<VerifStats> workerVerifStats(numWorkers);
+    
+    atomic<int> nextSet(0);
+    atomic<bool> deadlinePassed(false);
+    
+    threadPool.parallelFor(numWorkers,
+                           1,
+                           [&](int c, int beg, int end)
+    {
+        for(int s = nextSet++; s < potSets.size(); s = nextSet++){
+//            cout << "s = " << s << endl;
+            if(deadlinePassed || budget.isExpired()){
+                deadlinePassed = true;
+                break;
             }
+            PotMatchSet curSet = getPotMatchSet(potMatches, potSets[s]);
+        
+            vectorVector3d pointsMap;
+            vectorVector4d planesMap;
+            std::vector<Vector6d> linesMap;
+            vectorVector3d pointsFrame;
+            vectorVector4d planesFrame;
+            std::vector<Vector6d> linesFrame;
+
+            for(int ch = 0; ch < curSet.size(); ++ch) {
+//                cout << "map " << ch << ": " << mapObjInstances[curSet[ch].plane1].getNormal().transpose() << endl;
+                planesMap.push_back(mapObjInstances[curSet[ch].plane1].getNormal());
+                const vectorLineSeg &allLinesMap = mapObjInstances[curSet[ch].plane1].getLineSegs();
+                for (int lm = 0; lm < curSet[ch].lineSegs1.size(); ++lm) {
+                    linesMap.push_back(allLinesMap[curSet[ch].lineSegs1[lm]].toPointNormalEq());
+                }
     
-//            cout << "frame " << ch << ": " << frameObjInstances[potSets[s][ch].plane2].getNormal().transpose() << endl;
-            planesFrame.push_back(frameObjInstances[potSets[s][ch].plane2].getNormal());
-            const vectorLineSeg &allLinesFrame = frameObjInstances[potSets[s][ch].plane2].getLineSegs();
-            for (int lf = 0; lf < potSets[s][ch].lineSegs2.size(); ++lf) {
-                linesFrame.push_back(allLinesFrame[potSets[s][ch].lineSegs2[lf]].toPointNormalEq());
+//                cout << "frame " << ch << ": " << frameObjInstances[curSet[ch].plane2].getNormal().transpose() << endl;
+                planesFrame.push_back(frameObjInstances[curSet[ch].plane2].getNormal());
+                const vectorLineSeg &allLinesFrame = frameObjInstances[curSet[ch].plane2].getLineSegs();
+                for (int lf = 0; lf < curSet[ch].lineSegs2.size(); ++lf) {
+                    linesFrame.push_back(allLinesFrame[curSet[ch].lineSegs2[lf]].toPointNormalEq());
+                }
             }
-        }
         
-        bool fullConstrRot = true, fullConstrTrans = true;
+            bool fullConstrRot = true, fullConstrTrans = true;
 
-        Vector7d transformComp = Matching::bestTransformPlanes(planesMap,
-                                                               planesFrame,
-                                                               sinValsThresh,
-                                                               fullConstrRot);
+            Vector7d transformComp = Matching::bestTransformPlanes(planesMap,
+                                                                   planesFrame,
+                                                                   sinValsThresh,
+                                                                   fullConstrRot);
         
-//        vectorVector3d retPointsMap;
-//        vectorVector3d retVirtPointsMap;
-//        vectorVector3d retDirsMap;
-//        std::vector<double> retDistsMap;
-//        vectorVector3d retDistDirsMap;
-//        vectorVector3d retDistPtsMap;
-//        vectorVector3d retDistPtsDirsMap;
-//        Matching::convertToPointsDirsDists(pointsMap,
-//                                           planesMap,
-//                                           linesMap,
-//                                           retPointsMap,
-//                                           retVirtPointsMap,
-//                                           retDirsMap,
-//                                           retDistsMap,
-//                                           retDistDirsMap,
-//                                           retDistPtsMap,
-//                                           retDistPtsDirsMap);
-//
-//        vectorVector3d retPointsFrame;
-//        vectorVector3d retVirtPointsFrame;
-//        vectorVector3d retDirsFrame;
-//        std::vector<double> retDistsFrame;
-//        vectorVector3d retDistDirsFrame;
-//        vectorVector3d retDistPtsFrame;
-//        vectorVector3d retDistPtsDirsFrame;
-//        Matching::convertToPointsDirsDists(pointsFrame,
-//                                           planesFrame,
-//                                           linesFrame,
-//                                           retPointsFrame,
-//                                           retVirtPointsFrame,
-//                                           retDirsFrame,
-//                                           retDistsFrame,
-//                                           retDistDirsFrame,
-//                                           retDistPtsFrame,
-//                                           retDistPtsDirsFrame);
-//
-////		Vector7d curTransform;
-//		bool fullConstrRot2, fullConstrTrans2;
-//
-//
-//        Vector7d transformComp2 = Matching::bestTransformPointsDirsDists(retPointsMap,
-//                                                                        retPointsFrame,
-//                                                                        vector<double>(retPointsMap.size(), 1.0),
-//                                                                        retVirtPointsMap,
-//                                                                        retVirtPointsFrame,
-//                                                                        vector<double>(retVirtPointsMap.size(), 1.0),
-//                                                                        retDirsMap,
-//                                                                        retDirsFrame,
-//                                                                        vector<double>(retDirsMap.size(), 1.0),
-//                                                                        retDistsMap,
-//                                                                        retDistsFrame,
-//                                                                        retDistDirsMap,
-//                                                                        vector<double>(retDistsMap.size(), 1.0),
-//                                                                        retDistPtsMap,
-//                                                                        retDistPtsFrame,
-//                                                                        retDistPtsDirsMap,
-//                                                                        vector<double>(retDistPtsMap.size(), 1.0),
-//                                                                        sinValsThresh,
-//                                                                        fullConstrRot2,
-//                                                                        fullConstrTrans2);
-//
-//        if(fullConstrRot != (fullConstrRot2 && fullConstrTrans2)){
-//            cout << "constraints not consistant" << endl;
-//            char a;
-//            cin >> a;
-//        }
-//        else if(fullConstrRot){
-//            double diff = Misc::transformLogDist(transformComp, transformComp2);
-//            if(diff > 0.01){
-//                cout << "transformation not consistent" << endl;
-//                cout << transformComp.transpose() << endl;
-//                cout << transformComp2.transpose() << endl;
-//
+//            vectorVector3d retPointsMap;
+//            vectorVector3d retVirtPointsMap;
+//            vectorVector3d retDirsMap;
+//            std::vector<double> retDistsMap;
+//            vectorVector3d retDistDirsMap;
+//            vectorVector3d retDistPtsMap;
+//            vectorVector3d retDistPtsDirsMap;
+//            Matching::convertToPointsDirsDists(pointsMap,
+//                                               planesMap,
+//                                               linesMap,
+//                                               retPointsMap,
+//                                               retVirtPointsMap,
+//                                               retDirsMap,
+//                                               retDistsMap,
+//                                               retDistDirsMap,
+//                                               retDistPtsMap,
+//                                               retDistPtsDirsMap);
+//    
+//            vectorVector3d retPointsFrame;
+//            vectorVector3d retVirtPointsFrame;
+//            vectorVector3d retDirsFrame;
+//            std::vector<double> retDistsFrame;
+//            vectorVector3d retDistDirsFrame;
+//            vectorVector3d retDistPtsFrame;
+//            vectorVector3d retDistPtsDirsFrame;
+//            Matching::convertToPointsDirsDists(pointsFrame,
+//                                               planesFrame,
+//                                               linesFrame,
+//                                               retPointsFrame,
+//                                               retVirtPointsFrame,
+//                                               retDirsFrame,
+//                                               retDistsFrame,
+//                                               retDistDirsFrame,
+//                                               retDistPtsFrame,
+//                                               retDistPtsDirsFrame);
+//    
+//    //		Vector7d curTransform;
+//            bool fullConstrRot2, fullConstrTrans2;
+//    
+//    
+//            Vector7d transformComp2 = Matching::bestTransformPointsDirsDists(retPointsMap,
+//                                                                            retPointsFrame,
+//                                                                            vector<double>(retPointsMap.size(), 1.0),
+//                                                                            retVirtPointsMap,
+//                                                                            retVirtPointsFrame,
+//                                                                            vector<double>(retVirtPointsMap.size(), 1.0),
+//                                                                            retDirsMap,
+//                                                                            retDirsFrame,
+//                                                                            vector<double>(retDirsMap.size(), 1.0),
+//                                                                            retDistsMap,
+//                                                                            retDistsFrame,
+//                                                                            retDistDirsMap,
+//                                                                            vector<double>(retDistsMap.size(), 1.0),
+//                                                                            retDistPtsMap,
+//                                                                            retDistPtsFrame,
+//                                                                            retDistPtsDirsMap,
+//                                                                            vector<double>(retDistPtsMap.size(), 1.0),
+//                                                                            sinValsThresh,
+//                                                                            fullConstrRot2,
+//                                                                            fullConstrTrans2);
+//    
+//            if(fullConstrRot != (fullConstrRot2 && fullConstrTrans2)){
+//                cout << "constraints not consistant" << endl;
 //                char a;
 //                cin >> a;
 //            }
-//        }
+//            else if(fullConstrRot){
+//                double diff = Misc::transformLogDist(transformComp, transformComp2);
+//                if(diff > 0.01){
+//                    cout << "transformation not consistent" << endl;
+//                    cout << transformComp.transpose() << endl;
+//                    cout << transformComp2.transpose() << endl;
+//    
+//                    char a;
+//                    cin >> a;
+//                }
+//            }
 
-//        cout << "transformComp = " << transformComp.transpose() << endl;
-//        cout << "fullConstrRot = " << fullConstrRot << endl;
-//        cout << "fullConstrTrans = " << fullConstrTrans << endl;
+//            cout << "transformComp = " << transformComp.transpose() << endl;
+//            cout << "fullConstrRot = " << fullConstrRot << endl;
+//            cout << "fullConstrTrans = " << fullConstrTrans << endl;
 
-		bool isAdded = false;
-		if(fullConstrRot && fullConstrTrans){
-            vector<double> intAreaPlanes;
-            vector<vector<double> > intLenLines;
+            // hypotheses outside of the confidence region are rejected before computing intersections
+            if(posePrior.isSet && !checkPosePrior(transformComp, posePrior)){
+                continue;
+            }
             
-            double score = scoreTransformByProjection(transformComp,
-                                                      potSets[s],
-                                                      mapObjInstances,
-                                                      frameObjInstances,
-                                                      intAreaPlanes,
-                                                      intLenLines,
-                                                      planeEqDiffThresh,
-                                                      lineEqDiffThresh,
-                                                      intAreaThresh,
-                                                      intLenThresh/*,
-                                                      viewer,
-                                                      viewPort1, viewPort2*/);
+            bool isAdded = false;
+            if(fullConstrRot && fullConstrTrans){
+                ++workerVerifStats[c].numVerified;
+                
+                // cheap evidence first, most of the hypotheses are wrong
+                if(sprtParams.enabled){
+                    int decision = 0;
+                    int numSamples = 0;
+                    bool sprtPassed = checkSprt(transformComp,
+                                                curSet,
+                                                mapPlanes,
+                                                framePlanes,
+                                                frameOrder,
+                                                sprtParams,
+                                                decision,
+                                                numSamples);
+                    workerVerifStats[c].numSprtSamples += numSamples;
+                    if(decision < 0){
+                        ++workerVerifStats[c].numSprtRejected;
+                    }
+                    else if(decision > 0){
+                        ++workerVerifStats[c].numSprtPassed;
+                    }
+                    else{
+                        ++workerVerifStats[c].numSprtUndecided;
+                    }
+                    if(!sprtPassed){
+                        continue;
+                    }
+                }
+                
+                PlaneVals intAreaPlanes;
+                PlaneLineVals intLenLines;
             
-            if(score > scoreThresh){
-				vector<double> appDiffs;
-				for(int ch = 0; ch < potSets[s].size(); ++ch){
-					appDiffs.push_back(potSets[s][ch].planeAppDiff);
-				}
-				transforms.emplace_back(transformComp,
-										potSets[s],
-                                        intAreaPlanes,
-                                        intLenLines);
-				isAdded = true;
-			}
+                double score = scoreTransformByProjection(transformComp,
+                                                          curSet,
+                                                          mapObjInstances,
+                                                          frameObjInstances,
+                                                          intAreaPlanes,
+                                                          intLenLines,
+                                                          planeEqDiffThresh,
+                                                          lineEqDiffThresh,
+                                                          intAreaThresh,
+                                                          intLenThresh,
+                                                          hullIntersect/*,
+                                                          viewer,
+                                                          viewPort1, viewPort2*/);
             
-		}
+                ++workerVerifStats[c].numScored;
+                if(score > scoreThresh){
+                    workerTransforms[c].emplace_back(s, ValidTransform(transformComp,
+                                                                        curSet,
+                                                                        intAreaPlanes,
+                                                                        intLenLines));
+                    ++workerVerifStats[c].numAccepted;
+                    isAdded = true;
+                }
+            
+            }
 
-//		if(viewer && isAdded){
-//            cout << "transformComp = " << transformComp.transpose() << endl;
-//
-//			for(int p = 0; p < potSets[s].size(); ++p){
-//				int om = potSets[s][p].plane1;
-//				int of = potSets[s][p].plane2;
-//
-//				viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
-//														1.0,
-//														string("plane1_") + to_string(om),
-//														viewPort1);
-//				viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
-//														1.0,
-//														string("plane2_") + to_string(of),
-//														viewPort2);
-//			}
-//
-//			// time for watching
-//			viewer->resetStoppedFlag();
-//
-////			viewer->initCameraParameters();
-////			viewer->setCameraPosition(0.0, 0.0, -6.0, 0.0, 1.0, 0.0);
-//			while (!viewer->wasStopped()){
-//				viewer->spinOnce (100);
-//				std::this_thread::sleep_for(std::chrono::milliseconds(50));
-//			}
-//
-//            for(int p = 0; p < potSets[s].size(); ++p){
-//                int om = potSets[s][p].plane1;
-//                int of = potSets[s][p].plane2;
-//
-//				viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
-//														shadingLevel,
-//														string("plane1_") + to_string(om),
-//														viewPort1);
-//				viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
-//														shadingLevel,
-//														string("plane2_") + to_string(of),
-//														viewPort2);
-//			}
-//		}
-	}
+//            if(viewer && isAdded){
+//                cout << "transformComp = " << transformComp.transpose() << endl;
+//    
+//                for(int p = 0; p < curSet.size(); ++p){
+//                    int om = curSet[p].plane1;
+//                    int of = curSet[p].plane2;
+//    
+//                    viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
+//                                                            1.0,
+//                                                            string("plane1_") + to_string(om),
+//                                                            viewPort1);
+//                    viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
+//                                                            1.0,
+//                                                            string("plane2_") + to_string(of),
+//                                                            viewPort2);
+//                }
+//    
+//                // time for watching
+//                viewer->resetStoppedFlag();
+//    
+//    //			viewer->initCameraParameters();
+//    //			viewer->setCameraPosition(0.0, 0.0, -6.0, 0.0, 1.0, 0.0);
+//                while (!viewer->wasStopped()){
+//                    viewer->spinOnce (100);
+//                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+//                }
+//    
+//                for(int p = 0; p < curSet.size(); ++p){
+//                    int om = curSet[p].plane1;
+//                    int of = curSet[p].plane2;
+//    
+//                    viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
+//                                                            shadingLevel,
+//                                                            string("plane1_") + to_string(om),
+//                                                            viewPort1);
+//                    viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY,
+//                                                            shadingLevel,
+//                                                            string("plane2_") + to_string(of),
+//                                                            viewPort2);
+//                }
+//            }
+        }
+    });
+    
+    if(deadlinePassed){
+        cout << "deadline passed, using hypotheses verified so far" << endl;
+        truncated = true;
+    }
+    
+    // index of the set, index of the worker and index of the transform
+    vector<pair<int, pair<int, int>>> setToTransform;
+    for(int w = 0; w < workerTransforms.size(); ++w){
+        for(int t = 0; t < workerTransforms[w].size(); ++t){
+            setToTransform.emplace_back(workerTransforms[w][t].first, make_pair(w, t));
+        }
+    }
+    sort(setToTransform.begin(), setToTransform.end());
+    
+	std::vector<ValidTransform> transforms;
+    for(const pair<int, pair<int, int>> &st : setToTransform){
+        transforms.push_back(workerTransforms[st.second.first][st.second.second].second);
+    }
+    
+    verifStats = VerifStats();
+    for(const VerifStats &curVerifStats : workerVerifStats){
+        verifStats += curVerifStats;
+    }
+    cout << "verified = " << verifStats.numVerified
+         << ", SPRT rejected = " << verifStats.numSprtRejected
+         << ", passed = " << verifStats.numSprtPassed
+         << ", undecided = " << verifStats.numSprtUndecided
+         << ", samples = " << verifStats.numSprtSamples
+         << ", scored = " << verifStats.numScored
+         << ", accepted = " << verifStats.numAccepted << endl;
 
     chrono::high_resolution_clock::time_point endTransformTime = chrono::high_resolution_clock::now();
+    
+    stats.appTime += chrono::duration_cast<chrono::milliseconds>(endAppTime - startTime);
+    stats.tripletsTime += chrono::duration_cast<chrono::milliseconds>(endTripletTime - endAppTime);
+    stats.transformTime += chrono::duration_cast<chrono::milliseconds>(endTransformTime - endTripletTime);
+    
+    return transforms;
+}
 
+Matching::MatchType Matching::searchShards(const Settings &settings,
+                                           ThreadPool &threadPool,
+                                           Scratch &scratch,
+                                           Stats &stats,
+                                           const vectorObjInstance &frameObjInstances,
+                                           const std::vector<MapShard> &mapShards,
+                                           const Budget &budget,
+                                           const PosePrior &posePrior,
+                                           MatchingCache *cache,
+                                           MatchResult &result,
+                                           pcl::visualization::PCLVisualizer::Ptr viewer,
+                                           int viewPort1,
+                                           int viewPort2)
+{
+	cout << "Matching::searchShards" << endl;
+    bool &truncated = result.truncated;
+    VerifStats &verifStats = result.verifStats;
+    vectorVector7d &bestTrans = result.bestTrans;
+    std::vector<double> &bestTransProbs = result.bestTransProbs;
+    std::vector<double> &bestTransFits = result.bestTransFits;
+    std::vector<int> &bestTransDistinct = result.bestTransDistinct;
+    std::vector<ValidTransform> &retTransforms = result.transforms;
+    double kernelMaxExp = settings.kernelMaxExp;
+    const string &aggregator = settings.aggregator;
+    double voteTransCellSize = settings.voteTransCellSize;
+    double voteRotCellSize = settings.voteRotCellSize;
+    int voteNumPeaks = settings.voteNumPeaks;
+    bool voteRefine = settings.voteRefine;
+    
+    Stats curStats;
+    std::vector<ValidTransform> transforms;
+    int numMapObjs = 0;
+    if(mapShards.size() == 1){
+        transforms = generateTransforms(settings,
+                                        threadPool,
+                                        curStats,
+                                        frameObjInstances,
+                                        *mapShards.front().objInstances,
+                                        mapShards.front().index,
+                                        budget,
+                                        posePrior,
+                                        truncated,
+                                        verifStats,
+                                        cache,
+                                        viewer,
+                                        viewPort1,
+                                        viewPort2);
+        numMapObjs = mapShards.front().objInstances->size();
+    }
+    else{
+        // every shard is matched independently, the cache and the viewer are bound to a single map
+        vector<vector<ValidTransform>> shardTransforms(mapShards.size());
+        vector<Stats> shardStats(mapShards.size());
+        vector<VerifStats> shardVerifStats(mapShards.size());
+        vector<char> shardTruncated(mapShards.size(), false);
+        // frame hulls are shared by the shards, so exact values are computed before the parallel stage
+        for(const ObjInstance &obj : frameObjInstances){
+            obj.getHull().computeExact();
+        }
+        threadPool.parallelFor(mapShards.size(),
+                               1,
+                               [&](int c, int beg, int end)
+        {
+            for(int s = beg; s < end; ++s){
+                bool curTruncated = false;
+                shardTransforms[s] = generateTransforms(settings,
+                                                        threadPool,
+                                                        shardStats[s],
+                                                        frameObjInstances,
+                                                        *mapShards[s].objInstances,
+                                                        mapShards[s].index,
+                                                        budget,
+                                                        posePrior,
+                                                        curTruncated,
+                                                        shardVerifStats[s],
+                                                        nullptr);
+                shardTruncated[s] = curTruncated;
+            }
+        });
+        
+        // map objects of consecutive shards are numbered consecutively
+        truncated = false;
+        verifStats = VerifStats();
+        for(int s = 0; s < mapShards.size(); ++s){
+            for(ValidTransform &curTransform : shardTransforms[s]){
+                for(PotMatch &curMatch : curTransform.matchSet){
+                    curMatch.plane1 += numMapObjs;
+                }
+                transforms.push_back(curTransform);
+            }
+            numMapObjs += mapShards[s].objInstances->size();
+            
+            truncated = truncated || shardTruncated[s];
+            verifStats += shardVerifStats[s];
+            curStats += shardStats[s];
+        }
+    }
+    
+    chrono::high_resolution_clock::time_point endTransformTime = chrono::high_resolution_clock::now();
 
 	cout << "transforms.size() = " << transforms.size() << endl;
 	retTransforms = transforms;
+	// inverted index from map and frame objects to transformations that match them,
+	// a transformation is repeated as many times as the object appears in its match set
+	vector<vector<int>> mapObjToTrans(numMapObjs);
+	vector<vector<int>> frameObjToTrans(frameObjInstances.size());
+	vector<g2o::SE3Quat, Eigen::aligned_allocator<g2o::SE3Quat>> transSE3Quats;
 	for(int t = 0; t < transforms.size(); ++t){
-		// weight depending on a number of times the object was matched weighted with distance
-		// the more matches in a vicinity the lesser the overall weight
-		vector<float> frameObjInvWeights(transforms[t].matchSet.size(), 1.0);
-		vector<float> mapObjInvWeights(transforms[t].matchSet.size(), 1.0);
-		for(int tc = 0; tc < transforms.size(); ++tc){
-			for(int p = 0; p < transforms[t].matchSet.size(); ++p){
-				g2o::SE3Quat trans(transforms[t].transform);
-				g2o::SE3Quat transComp(transforms[tc].transform);
-				g2o::SE3Quat diff = trans.inverse() * transComp;
-				Vector6d logMapDiff = diff.log();
-				double dist = logMapDiff.transpose() * logMapDiff;
-				for(int pc = 0; pc < transforms[tc].matchSet.size(); ++pc){
-                    if(transforms[t].matchSet[p].plane1 == transforms[tc].matchSet[pc].plane1){
-                        mapObjInvWeights[p] += exp(-dist);
-                    }
-                    if(transforms[t].matchSet[p].plane2 == transforms[tc].matchSet[pc].plane2){
-						frameObjInvWeights[p] += exp(-dist);
+		transSE3Quats.emplace_back(transforms[t].transform);
+		for(int p = 0; p < transforms[t].matchSet.size(); ++p){
+			mapObjToTrans[transforms[t].matchSet[p].plane1].push_back(t);
+			frameObjToTrans[transforms[t].matchSet[p].plane2].push_back(t);
+		}
+	}
+	// without time for weighting, transformations are scored as if all matches were unique
+	atomic<bool> deadlinePassed(false);
+	threadPool.parallelFor(transforms.size(),
+						   threadPool.chooseChunkSize(transforms.size()),
+						   [&](int c, int beg, int end)
+	{
+		// exp(-dist) to the current transformation, computed once for every pair
+		vector<double> expDists(transforms.size(), -1.0);
+		vector<int> expDistsSet;
+		for(int t = beg; t < end; ++t){
+			g2o::SE3Quat transInv = transSE3Quats[t].inverse();
+			auto compExpDist = [&](int tc){
+				if(expDists[tc] < 0.0){
+					g2o::SE3Quat diff = transInv * transSE3Quats[tc];
+					Vector6d logMapDiff = diff.log();
+					double dist = logMapDiff.transpose() * logMapDiff;
+					expDists[tc] = exp(-dist);
+					expDistsSet.push_back(tc);
+				}
+				return expDists[tc];
+			};
+			
+			// weight depending on a number of times the object was matched weighted with distance
+			// the more matches in a vicinity the lesser the overall weight
+			vector<float> frameObjInvWeights(transforms[t].matchSet.size(), 1.0);
+			vector<float> mapObjInvWeights(transforms[t].matchSet.size(), 1.0);
+			if(!deadlinePassed && budget.isExpired()){
+				deadlinePassed = true;
+			}
+			if(!deadlinePassed){
+				for(int p = 0; p < transforms[t].matchSet.size(); ++p){
+					for(int tc : mapObjToTrans[transforms[t].matchSet[p].plane1]){
+						mapObjInvWeights[p] += compExpDist(tc);
 					}
+					for(int tc : frameObjToTrans[transforms[t].matchSet[p].plane2]){
+						frameObjInvWeights[p] += compExpDist(tc);
+					}
+				}
+				for(int tc : expDistsSet){
+					expDists[tc] = -1.0;
 				}
+				expDistsSet.clear();
 			}
+//			cout << "intAreas = " << transforms[t].intAreas << endl;
+//			cout << "mapObjInvWeights = " << mapObjInvWeights << endl;
+			double curScore = 0.0;
+			for(int p = 0; p < transforms[t].matchSet.size(); ++p){
+//				cout << "exp(-transforms[t].appDiffs[p]) = " << exp(-transforms[t].appDiffs[p]) << endl;
+				curScore += transforms[t].intAreaPlanes[p]/frameObjInvWeights[p]*exp(-transforms[t].matchSet[p].planeAppDiff);
+			}
+			transforms[t].score = curScore;
+//			cout << "score = " << transforms[t].score << endl;
 		}
-//		cout << "intAreas = " << transforms[t].intAreas << endl;
-//		cout << "mapObjInvWeights = " << mapObjInvWeights << endl;
-		double curScore = 0.0;
-		for(int p = 0; p < transforms[t].matchSet.size(); ++p){
-//            cout << "exp(-transforms[t].appDiffs[p]) = " << exp(-transforms[t].appDiffs[p]) << endl;
-			curScore += transforms[t].intAreaPlanes[p]/frameObjInvWeights[p]*exp(-transforms[t].matchSet[p].planeAppDiff);
-		}
-		transforms[t].score = curScore;
-//		cout << "score = " << transforms[t].score << endl;
-	}
+	});
 
     chrono::high_resolution_clock::time_point endScoreTime = chrono::high_resolution_clock::now();
+    
+    if(deadlinePassed){
+        cout << "deadline passed while weighting scores" << endl;
+        truncated = true;
+    }
 
 //    cout << "Exporting distances" << endl;
 //	vector<vector<double>> distMat(transforms.size(), vector<double>(transforms.size(), 0));
@@ -424,31 +1010,42 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
 	if(transforms.size() > 0){
 //        cout << "construct probability distribution using gaussian kernels" << endl;
 		// construct probability distribution using gaussian kernels
-		vectorProbDistKernel dist;
 		Eigen::Matrix<double, 6, 6> distInfMat = Eigen::Matrix<double, 6, 6>::Identity();
 		// information matrix for position
 		distInfMat.block<3, 3>(3, 3) = 10.0 * Eigen::Matrix<double, 3, 3>::Identity();
 		// information matrix for orientation
 		distInfMat.block<3, 3>(0, 0) = 10.0 * Eigen::Matrix<double, 3, 3>::Identity();
-		for(int t = 0; t < transforms.size(); ++t){
-			dist.emplace_back(transforms[t].transform, distInfMat, transforms[t].score);
+		vector<pair<double, int>> transProb;
+		if(aggregator == "voting"){
+			// votes into a sparse grid, peaks represented by the best transformations in their cells
+			VoteAccum accum(voteTransCellSize, voteRotCellSize);
+			for(int t = 0; t < transforms.size(); ++t){
+				accum.addVote(transforms[t].transform, transforms[t].score, t);
+			}
+			transProb = accum.getPeaks(voteNumPeaks, voteRefine);
+			reverse(transProb.begin(), transProb.end());
 		}
+		else{
+			ProbDist dist(distInfMat, kernelMaxExp);
+			for(int t = 0; t < transforms.size(); ++t){
+				dist.addKernel(transforms[t].transform, transforms[t].score);
+			}
 
-		vector<pair<double, int>> transProb;
-		// find point for which the probability is the highest
-//		int bestInd = 0;
-//		double bestScore = numeric_limits<double>::lowest();
-		for(int t = 0; t < transforms.size(); ++t){
-			double curProb = evalPoint(transforms[t].transform, dist);
-//			cout << "transform = " << transforms[t].transpose() << endl;
-//			cout << "prob = " << curProb << endl;
-//			if(bestScore < curScore){
-//				bestScore = curScore;
-//				bestInd = t;
-//			}
-			transProb.emplace_back(curProb, t);
+			// find point for which the probability is the highest
+//			int bestInd = 0;
+//			double bestScore = numeric_limits<double>::lowest();
+			for(int t = 0; t < transforms.size(); ++t){
+				double curProb = dist.eval(transforms[t].transform);
+//				cout << "transform = " << transforms[t].transpose() << endl;
+//				cout << "prob = " << curProb << endl;
+//				if(bestScore < curScore){
+//					bestScore = curScore;
+//					bestInd = t;
+//				}
+				transProb.emplace_back(curProb, t);
+			}
+			sort(transProb.begin(), transProb.end());
 		}
-		sort(transProb.begin(), transProb.end());
 
 		// seeking for at most 2 best maximas
 		for(int t = transProb.size() - 1; t >= 0 && bestTrans.size() < 2; --t){
@@ -473,10 +1070,32 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
 //            vector<Vector7d> newBestTrans;
 //            vector<double> newBestTransProbs;
 
-            pcl::PointCloud<pcl::PointXYZRGB>::Ptr mapPc(new pcl::PointCloud<pcl::PointXYZRGB>());
-            for(int om = 0; om < mapObjInstances.size(); ++om){
-                pcl::PointCloud<pcl::PointXYZRGB>::Ptr curMapPc = mapObjInstances[om].getPoints();
-                mapPc->insert(mapPc->end(), curMapPc->begin(), curMapPc->end());
+            vector<pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr> mapPcs(mapShards.size());
+            vector<pcl::KdTreeFLANN<pcl::PointXYZRGB>> localKdTrees(mapShards.size());
+            vector<const pcl::KdTreeFLANN<pcl::PointXYZRGB> *> kdTrees(mapShards.size());
+            for(int s = 0; s < mapShards.size(); ++s){
+                const vectorObjInstance &mapObjInstances = *mapShards[s].objInstances;
+                const MapIndex *mapIndex = mapShards[s].index;
+                // kd-tree of the map is built once, together with its index
+                if(mapIndex && mapIndex->hasKdTree() && mapIndex->isValidFor(mapObjInstances)){
+                    mapPcs[s] = mapIndex->getPoints();
+                    kdTrees[s] = &mapIndex->getKdTree();
+                }
+                else{
+                    pcl::PointCloud<pcl::PointXYZRGB>::Ptr curMapPc(new pcl::PointCloud<pcl::PointXYZRGB>());
+                    for(int om = 0; om < mapObjInstances.size(); ++om){
+                        pcl::PointCloud<pcl::PointXYZRGB>::Ptr curObjPc = mapObjInstances[om].getPoints();
+                        curMapPc->insert(curMapPc->end(), curObjPc->begin(), curObjPc->end());
+                    }
+                    mapPcs[s] = curMapPc;
+                    if(!curMapPc->empty()){
+                        localKdTrees[s].setInputCloud(curMapPc);
+                        kdTrees[s] = &localKdTrees[s];
+                    }
+                    else{
+                        kdTrees[s] = nullptr;
+                    }
+                }
             }
 //            pcl::PointCloud<pcl::PointXYZRGB>::Ptr framePc(new pcl::PointCloud<pcl::PointXYZRGB>());
 //            for(int of = 0; of < frameObjInstances.size(); ++of){
@@ -484,27 +1103,46 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
 //                framePc->insert(framePc->end(), curFramePc->begin(), curFramePc->end());
 //            }
 
-            pcl::KdTreeFLANN<pcl::PointXYZRGB> kdTree;
-            kdTree.setInputCloud(mapPc);
+            // scratch buffer for frame points, reused by all transformations
+            if(!scratch.framePcTrans){
+                scratch.framePcTrans.reset(new pcl::PointCloud<pcl::PointXYZRGB>());
+            }
+            pcl::PointCloud<pcl::PointXYZRGB>::Ptr framePcTrans = scratch.framePcTrans;
+            {
+                int nFramePts = 0;
+                for(const ObjInstance &obj : frameObjInstances){
+                    nFramePts += obj.getPoints()->size();
+                }
+                framePcTrans->resize(nFramePts);
+            }
 
             for(int t = 0; t < bestTrans.size(); ++t) {
+                // transformations without a fit score can not be accepted
+                if(budget.isExpired()){
+                    cout << "deadline passed, dropping " << bestTrans.size() - t << " transformations" << endl;
+                    bestTrans.resize(t);
+                    bestTransProbs.resize(t);
+                    truncated = true;
+                    break;
+                }
                 cout << "fit score on transformation " << t << endl;
                 
-                vectorObjInstance frameObjInstancesTrans = frameObjInstances;
-                for(ObjInstance &obj : frameObjInstancesTrans){
-                    obj.transform(bestTrans[t]);
-                }
-
-//                g2o::SE3Quat curTransSE3Quat(bestTrans[t]);
-//                Eigen::Matrix4d curTransMat = curTransSE3Quat.to_homogeneous_matrix();
-//
-                pcl::PointCloud<pcl::PointXYZRGB>::Ptr framePcTrans(new pcl::PointCloud<pcl::PointXYZRGB>());
+                g2o::SE3Quat curTransSE3Quat(bestTrans[t]);
+                Eigen::Matrix4f curTransMat = curTransSE3Quat.to_homogeneous_matrix().cast<float>();
 //                pcl::transformPointCloud(*framePc, *framePcTrans, curTransMat);
-    
-                for(ObjInstance &obj : frameObjInstancesTrans){
-                    framePcTrans->insert(framePcTrans->end(),
-                                         obj.getPoints()->begin(),
-                                         obj.getPoints()->end());
+                
+                // stream points of frame objects through the transformation,
+                // objects themselves stay untouched
+                {
+                    int p = 0;
+                    for(const ObjInstance &obj : frameObjInstances){
+                        for(const pcl::PointXYZRGB &pt : obj.getPoints()->points){
+                            pcl::PointXYZRGB &ptTrans = framePcTrans->points[p++];
+                            ptTrans = pt;
+                            ptTrans.getVector3fMap() = curTransMat.block<3, 3>(0, 0) * pt.getVector3fMap() +
+                                                       curTransMat.block<3, 1>(0, 3);
+                        }
+                    }
                 }
                 
                 vector<int> nnIndices(1);
@@ -513,12 +1151,21 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
                 int ptCnt = 0;
                 double maxDist = 0.0;
                 for(int p = 0; p < framePcTrans->size(); ++p){
-                    kdTree.nearestKSearch(framePcTrans->at(p), 1, nnIndices, nnDists);
+                    // the closest point over all shards
+                    double nnDist = std::numeric_limits<double>::max();
+                    for(const pcl::KdTreeFLANN<pcl::PointXYZRGB> *kdTree : kdTrees){
+                        if(kdTree && kdTree->nearestKSearch(framePcTrans->at(p), 1, nnIndices, nnDists) > 0){
+                            nnDist = std::min(nnDist, (double)nnDists[0]);
+                        }
+                    }
+                    if(nnDist == std::numeric_limits<double>::max()){
+                        continue;
+                    }
 
-                    fitScore += nnDists[0];
+                    fitScore += nnDist;
                     ++ptCnt;
                     
-                    maxDist = std::max(maxDist, (double)nnDists[0]);
+                    maxDist = std::max(maxDist, nnDist);
                 }
                 if(ptCnt > 0){
                     fitScore /= ptCnt;
@@ -555,21 +1202,26 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
                 {
                     vector<pair<int, int>> matches;
                     set<int> frameIdxsSet;
-                    set<int> mapIdxsSet;
-                    for(int of = 0; of < frameObjInstancesTrans.size(); ++of) {
-                        for (int om = 0; om < mapObjInstances.size(); ++om) {
-                            const ObjInstance &frameObj = frameObjInstancesTrans[of];
-                            const ObjInstance &mapObj = mapObjInstances[om];
-                            if(frameObj.isMatching(mapObj)){
-                                matches.emplace_back(om, of);
-                                mapIdxsSet.insert(om);
-                                frameIdxsSet.insert(of);
+                    // objects of different shards are counted as different
+                    int mapDistinct = 0;
+                    for(int s = 0; s < mapShards.size(); ++s){
+                        const vectorObjInstance &mapObjInstances = *mapShards[s].objInstances;
+                        set<int> mapIdxsSet;
+                        for(int of = 0; of < frameObjInstances.size(); ++of) {
+                            for (int om = 0; om < mapObjInstances.size(); ++om) {
+                                const ObjInstance &frameObj = frameObjInstances[of];
+                                const ObjInstance &mapObj = mapObjInstances[om];
+                                if(frameObj.isMatching(mapObj, bestTrans[t], settings.hullIntersect)){
+                                    matches.emplace_back(om, of);
+                                    mapIdxsSet.insert(om);
+                                    frameIdxsSet.insert(of);
+                                }
                             }
                         }
+                        mapDistinct += countDifferent(mapIdxsSet,
+                                                      mapObjInstances);
                     }
                     
-                    int mapDistinct = countDifferent(mapIdxsSet,
-                                                     mapObjInstances);
                     int frameDistinct = countDifferent(frameIdxsSet,
                                                      frameObjInstances);
                     
@@ -594,7 +1246,9 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
                                                              "cloud_out",
                                                              viewPort1);
                     
-                    viewer->addPointCloud(mapPc, "cloud_map", viewPort1);
+                    for(int s = 0; s < mapPcs.size(); ++s){
+                        viewer->addPointCloud(mapPcs[s], string("cloud_map_") + to_string(s), viewPort1);
+                    }
 
                     viewer->resetStoppedFlag();
                     viewer->initCameraParameters();
@@ -618,43 +1272,18 @@ Matching::MatchType Matching::matchFrameToMap(const cv::FileStorage &fs,
 
     chrono::high_resolution_clock::time_point endTime = chrono::high_resolution_clock::now();
 
-    static chrono::milliseconds totalAppTime = chrono::milliseconds::zero();
-    static chrono::milliseconds totalTripletsTime = chrono::milliseconds::zero();
-    static chrono::milliseconds totalTransformTime = chrono::milliseconds::zero();
-    static chrono::milliseconds totalScoreTime = chrono::milliseconds::zero();
-    static chrono::milliseconds totalFitTime = chrono::milliseconds::zero();
-    static double meanTriTransTime = 0;
-    static double m2TriTransTime = 0;
-    static double maxTriTransTime = 0;
-    static int totalCnt = 0;
-
-    totalAppTime += chrono::duration_cast<chrono::milliseconds>(endAppTime - startTime);
-    totalTripletsTime += chrono::duration_cast<chrono::milliseconds>(endTripletTime - endAppTime);
-    totalTransformTime += chrono::duration_cast<chrono::milliseconds>(endTransformTime - endTripletTime);
-    totalScoreTime += chrono::duration_cast<chrono::milliseconds>(endScoreTime - endTransformTime);
-    totalFitTime += chrono::duration_cast<chrono::milliseconds>(endTime - endScoreTime);
-    ++totalCnt;
-
+    curStats.numCalls = 1;
+    curStats.scoreTime = chrono::duration_cast<chrono::milliseconds>(endScoreTime - endTransformTime);
+    curStats.fitTime = chrono::duration_cast<chrono::milliseconds>(endTime - endScoreTime);
     {
-        double newVal = chrono::duration_cast<chrono::milliseconds>(endTransformTime - endAppTime).count();
-        maxTriTransTime = max(maxTriTransTime, newVal);
-        double delta = newVal - meanTriTransTime;
-        meanTriTransTime += delta/totalCnt;
-        double delta2 = newVal - meanTriTransTime;
-        m2TriTransTime += delta*delta2;
-        
-        if(totalCnt > 1) {
-            double var = m2TriTransTime / (totalCnt - 1);
-            cout << "triplets + transform std dev = " << sqrt(var) << endl;
-            cout << "triplets + transform max = " << maxTriTransTime << endl;
-        }
+        // summed over shards
+        double newVal = (curStats.tripletsTime + curStats.transformTime).count();
+        curStats.triTransTimeSum = newVal;
+        curStats.triTransTimeSqSum = newVal * newVal;
+        curStats.maxTriTransTime = newVal;
     }
-    
-    cout << "Mean matching app time: " << (totalAppTime.count() / totalCnt) << endl;
-    cout << "Mean matching triplets time: " << (totalTripletsTime.count() / totalCnt) << endl;
-    cout << "Mean matching transform time: " << (totalTransformTime.count() / totalCnt) << endl;
-    cout << "Mean matching score time: " << (totalScoreTime.count() / totalCnt) << endl;
-    cout << "Mean matching fit time: " << (totalFitTime.count() / totalCnt) << endl;
+    curStats.verifStats = verifStats;
+    stats += curStats;
 
 	// No satisfying transformations - returning identity
 	if(bestTrans.size() == 0){
@@ -809,6 +1438,11 @@ vector<Matching::PotMatch> Matching::findPotMatches(const vectorObjInstance &map
                                                     double planeAppThresh,
                                                     double lineAppThresh,
                                                     double lineToLineAngThresh,
+                                                    const ObjInstance::DescriptorThresh &descThresh,
+                                                    int maxLineSubsetSize,
+                                                    int maxPotMatches,
+                                                    const MapIndex *mapIndex,
+                                                    MatchingCache *cache,
                                                     pcl::visualization::PCLVisualizer::Ptr viewer,
                                                     int viewPort1,
                                                     int viewPort2)
@@ -817,15 +1451,81 @@ vector<Matching::PotMatch> Matching::findPotMatches(const vectorObjInstance &map
     
     vector<PotMatch> potMatches;
     
-    vector<cv::Mat> frameObjFeats;
-    compObjFeatures(frameObjInstances, frameObjFeats);
-    vector<cv::Mat> mapObjFeats;
-    compObjFeatures(mapObjInstances, mapObjFeats);
+    bool mapIndexValid = mapIndex && mapIndex->isValidFor(mapObjInstances);
     
+    ObjInstance::HistMatrix frameHists;
+    ObjInstance::compHistMatrix(frameObjInstances.begin(), frameObjInstances.end(), frameHists);
+    ObjInstance::HistMatrix localMapHists;
+    const ObjInstance::HistMatrix *mapHists = &localMapHists;
+    // histograms of the map are gathered once, together with its index
+    if(mapIndexValid && mapIndex->hasHists()){
+        mapHists = &mapIndex->getHists();
+    }
+    else{
+        ObjInstance::compHistMatrix(mapObjInstances.begin(), mapObjInstances.end(), localMapHists);
+    }
+    
+    bool useDescIndex = mapIndexValid && mapIndex->hasDescriptors();
+    vectorObjDescriptor localMapDescs;
+    if(!useDescIndex){
+        for(const ObjInstance &obj : mapObjInstances){
+            localMapDescs.push_back(obj.compDescriptor());
+        }
+    }
+    
+    // cheap tests on descriptors first, full histograms only for the remaining candidates
+    vector<vector<int>> candidates(frameObjInstances.size());
+    vector<const vector<PotMatch> *> cachedPotMatches(frameObjInstances.size(), nullptr);
+    // row of every map object in candHists, -1 if it is not a candidate of any frame object
+    vector<int> candRows(mapObjInstances.size(), -1);
+    vector<int> candMapIdxs;
     for(int of = 0; of < frameObjInstances.size(); ++of){
-        for(int om = 0; om < mapObjInstances.size(); ++om){
-            cv::Mat histDiff = cv::abs(frameObjFeats[of] - mapObjFeats[om]);
-            double histDist = ObjInstance::compHistDist(frameObjFeats[of], mapObjFeats[om]);
+        if(cache){
+            cachedPotMatches[of] = cache->findPotMatches(frameObjInstances[of]);
+            if(cachedPotMatches[of]){
+                continue;
+            }
+        }
+        ObjInstance::Descriptor frameDesc = frameObjInstances[of].compDescriptor();
+        if(useDescIndex){
+            mapIndex->findCandidates(frameDesc, descThresh, candidates[of]);
+        }
+        else{
+            for(int om = 0; om < mapObjInstances.size(); ++om){
+                if(ObjInstance::checkDescriptors(frameDesc, localMapDescs[om], descThresh)){
+                    candidates[of].push_back(om);
+                }
+            }
+        }
+        for(int om : candidates[of]){
+            if(candRows[om] < 0){
+                candRows[om] = candMapIdxs.size();
+                candMapIdxs.push_back(om);
+            }
+        }
+    }
+    
+    // distances between all frame objects and the candidates in one pass
+    ObjInstance::HistMatrix candHists(candMapIdxs.size(), (int)ObjInstance::histBins);
+    for(int c = 0; c < candMapIdxs.size(); ++c){
+        candHists.row(c) = mapHists->row(candMapIdxs[c]);
+    }
+    Eigen::MatrixXf histDists;
+    ObjInstance::compHistDistMatrix(frameHists, candHists, histDists);
+    
+    vector<PotMatch> objPotMatches;
+    for(int of = 0; of < frameObjInstances.size(); ++of){
+        if(cachedPotMatches[of]){
+            for(PotMatch curPotMatch : *cachedPotMatches[of]){
+                curPotMatch.plane2 = of;
+                potMatches.push_back(curPotMatch);
+            }
+            continue;
+        }
+        objPotMatches.clear();
+        
+        for(int om : candidates[of]){
+            double histDist = histDists(of, candRows[om]);
             if(histDist < planeAppThresh){
                 
                 const vectorLineSeg &frameLineSegs = frameObjInstances[of].getLineSegs();
@@ -837,53 +1537,20 @@ vector<Matching::PotMatch> Matching::findPotMatches(const vectorObjInstance &map
                     }
                 }
                 
-                int numComb = (1 << potLineMatches.size());
-    
                 // TODO Add line appearance difference computation
                 vector<double> linesAppDiffs(potLineMatches.size(), 0.0);
                 
-                for(int c = 0; c < numComb; ++c){
-                    bool addFlag = true;
-                    vector<int> linesMap;
-                    vector<int> linesFrame;
-                    vector<double> curLinesAppDiffs;
-                    
-                    for(int l = 0; l < potLineMatches.size(); ++l){
-                        if(c & (1 << l)){
-                            
-                            if(linesAppDiffs[l] > lineAppThresh){
-                                addFlag = false;
-                                break;
-                            }
-                            else{
-                                for(int prevl = 0; prevl < linesMap.size(); ++prevl){
-                                    if(!checkLineToLineAng(vectorLineSeg{mapLineSegs[linesMap[prevl]],
-                                                                           mapLineSegs[potLineMatches[l].first]},
-                                                           vectorLineSeg{frameLineSegs[linesFrame[prevl]],
-                                                                           frameLineSegs[potLineMatches[l].second]},
-                                                           lineToLineAngThresh))
-                                    {
-                                        addFlag = false;
-                                        break;
-                                    }
-                                }
-                            }
-                            
-                            linesMap.push_back(potLineMatches[l].first);
-                            linesFrame.push_back(potLineMatches[l].second);
-                            curLinesAppDiffs.push_back(linesAppDiffs[l]);
-                        }
-                    }
-                    if(addFlag){
-//                        cout << "adding potential match between " << om << " and " << of << endl;
-                        potMatches.emplace_back(om,
-                                                linesMap,
-                                                of,
-                                                linesFrame,
-                                                histDist,
-                                                curLinesAppDiffs);
-                    }
-                }
+                PotMatch curPotMatch(om, LineIdxs(), of, LineIdxs(), histDist, LineVals());
+                addLineSubsets(mapLineSegs,
+                               frameLineSegs,
+                               potLineMatches,
+                               linesAppDiffs,
+                               lineAppThresh,
+                               lineToLineAngThresh,
+                               maxLineSubsetSize,
+                               0,
+                               curPotMatch,
+                               objPotMatches);
                 
             }
 
@@ -918,17 +1585,85 @@ vector<Matching::PotMatch> Matching::findPotMatches(const vectorObjInstance &map
 //                                                         viewPort2);
 //			}
         }
+        
+        if(cache){
+            cache->insertPotMatches(frameObjInstances[of], objPotMatches);
+        }
+        potMatches.insert(potMatches.end(), objPotMatches.begin(), objPotMatches.end());
     }
     
-    static constexpr int potMatchesThresh = 275;
-    if(potMatches.size() > potMatchesThresh) {
+    limitPotMatches(potMatches, maxPotMatches);
+    
+    return potMatches;
+}
+
+void Matching::addLineSubsets(const vectorLineSeg &mapLineSegs,
+                              const vectorLineSeg &frameLineSegs,
+                              const std::vector<std::pair<int, int>> &potLineMatches,
+                              const std::vector<double> &linesAppDiffs,
+                              double lineAppThresh,
+                              double lineToLineAngThresh,
+                              int maxLineSubsetSize,
+                              int startLine,
+                              PotMatch &curPotMatch,
+                              std::vector<PotMatch> &potMatches)
+{
+//    cout << "adding potential match between " << curPotMatch.plane1 << " and " << curPotMatch.plane2 << endl;
+    potMatches.push_back(curPotMatch);
+    
+    if(curPotMatch.lineSegs1.size() >= min(maxLineSubsetSize, (int)LineIdxs::capacity())){
+        return;
+    }
+    // pairs are added in order of their indices, so every subset is generated once
+    for(int l = startLine; l < potLineMatches.size(); ++l){
+        if(linesAppDiffs[l] > lineAppThresh){
+            continue;
+        }
+        // every superset of a subset that fails the check fails it as well
+        bool angOk = true;
+        for(int prevl = 0; prevl < curPotMatch.lineSegs1.size() && angOk; ++prevl){
+            angOk = checkLineToLineAng(vectorLineSeg{mapLineSegs[curPotMatch.lineSegs1[prevl]],
+                                                     mapLineSegs[potLineMatches[l].first]},
+                                       vectorLineSeg{frameLineSegs[curPotMatch.lineSegs2[prevl]],
+                                                     frameLineSegs[potLineMatches[l].second]},
+                                       lineToLineAngThresh);
+        }
+        if(!angOk){
+            continue;
+        }
+        
+        curPotMatch.lineSegs1.push_back(potLineMatches[l].first);
+        curPotMatch.lineSegs2.push_back(potLineMatches[l].second);
+        curPotMatch.lineSegAppDiffs.push_back(linesAppDiffs[l]);
+        
+        addLineSubsets(mapLineSegs,
+                       frameLineSegs,
+                       potLineMatches,
+                       linesAppDiffs,
+                       lineAppThresh,
+                       lineToLineAngThresh,
+                       maxLineSubsetSize,
+                       l + 1,
+                       curPotMatch,
+                       potMatches);
+        
+        curPotMatch.lineSegs1.pop_back();
+        curPotMatch.lineSegs2.pop_back();
+        curPotMatch.lineSegAppDiffs.pop_back();
+    }
+}
+
+void Matching::limitPotMatches(std::vector<PotMatch> &potMatches,
+                               int maxPotMatches)
+{
+    if(maxPotMatches > 0 && potMatches.size() > maxPotMatches) {
         vector<double> histDists;
         for (const PotMatch &pm : potMatches) {
             histDists.push_back(pm.planeAppDiff);
         }
         sort(histDists.begin(), histDists.end());
         
-        double newPlaneAppThresh = histDists[potMatchesThresh];
+        double newPlaneAppThresh = histDists[maxPotMatches];
         
         vector<PotMatch> newPotMatches;
         for (const PotMatch &pm : potMatches) {
@@ -938,157 +1673,204 @@ vector<Matching::PotMatch> Matching::findPotMatches(const vectorObjInstance &map
         }
         potMatches.swap(newPotMatches);
     }
-    
-    return potMatches;
 }
 
-vector<vector<Matching::PotMatch>> Matching::findPotSets(const vector<PotMatch> &potMatches,
-                                                         const vectorObjInstance &mapObjInstances,
-                                                         const vectorObjInstance &frameObjInstances,
-                                                         double planeDistThresh,
-                                                         double lineToLineAngThresh,
-                                                         double planeToPlaneAngThresh,
-                                                         double planeToLineAngThresh,
-                                                         pcl::visualization::PCLVisualizer::Ptr viewer,
-                                                         int viewPort1,
-                                                         int viewPort2)
+vector<Matching::PotSetIdxs> Matching::findPotSets(const vector<PotMatch> &potMatches,
+                                                   const vectorObjInstance &mapObjInstances,
+                                                   const vectorObjInstance &frameObjInstances,
+                                                   double planeDistThresh,
+                                                   double lineToLineAngThresh,
+                                                   double planeToPlaneAngThresh,
+                                                   double planeToLineAngThresh,
+                                                   ThreadPool &threadPool,
+                                                   const MapIndex *mapIndex,
+                                                   MatchingCache *cache,
+                                                   pcl::visualization::PCLVisualizer::Ptr viewer,
+                                                   int viewPort1,
+                                                   int viewPort2)
 {
-    vector<vector<PotMatch> > potSets;
-    vector<vector<int>> potSetsIdxs;
+    vector<PotSetIdxs> potSets;
     
     vector<vector<double>> frameObjDistances;
-    compObjDistances(frameObjInstances, frameObjDistances);
-    vector<vector<double>> mapObjDistances;
-    compObjDistances(mapObjInstances, mapObjDistances);
-    
-    // initialize with single matches
-    potSets.resize(potMatches.size());
-    for(int p = 0; p < potMatches.size(); ++p){
-        potSets[p].push_back(potMatches[p]);
-        potSetsIdxs.push_back(vector<int>{p});
-    }
-    // generate dublets and triplets
-    for(int ne = 2; ne <= 3; ++ne){
-//        cout << "ne = " << ne << endl;
-//        cout << "potSets.size() = " << potSets.size() << endl;
+    compObjDistances(frameObjInstances, frameObjDistances, cache);
+    
+    // map index can be used only if it covers the distance threshold
+    bool useMapIndex = mapIndex != nullptr &&
+                       planeDistThresh <= mapIndex->getMaxDist() &&
+                       mapIndex->isValidFor(mapObjInstances);
+    
+    // all checks are made between pairs of planes and lines, so a set is valid
+    // if and only if every pair of its potential matches is valid.
+    // Compatible pairs form a graph and valid triplets are its 3-cliques.
+    int numPotMatches = potMatches.size();
+    int numWords = (numPotMatches + 63) / 64;
+    // upper triangle of adjacency matrix, bit j in row i is set if i < j and i, j are compatible
+    vector<uint64_t> adjacency(numPotMatches * numWords, 0);
+    
+    if(useMapIndex){
+        cout << "using map index" << endl;
         
-        vector<vector<PotMatch> > newPotSets;
-        vector<vector<int>> newPotSetsIdxs;
-        unordered_set<uint64_t> newPotSetsIdxsSet;
-
-        for(int s = 0; s < potSets.size(); ++s){
+        // potential matches of every frame object grouped by map object
+        vector<unordered_map<int, vector<int>>> frameToMapToPotMatch(frameObjInstances.size());
+        vector<int> frameNumPotMatches(frameObjInstances.size(), 0);
+        for(int p = 0; p < numPotMatches; ++p){
+            frameToMapToPotMatch[potMatches[p].plane2][potMatches[p].plane1].push_back(p);
+            ++frameNumPotMatches[potMatches[p].plane2];
+        }
+        
+        int numFrameObjs = frameObjInstances.size();
+        int chunkSize = threadPool.chooseChunkSize(numFrameObjs);
+        int numChunks = ThreadPool::numChunks(numFrameObjs, chunkSize);
+        vector<vector<pair<int, int>>> chunkEdges(numChunks);
+        
+        threadPool.parallelFor(numFrameObjs, chunkSize, [&](int c, int fBeg, int fEnd){
+            // checks pair of potential matches and stores an edge if they are compatible
+            auto checkEdge = [&](int p1, int p2){
+                if(checkPotSet(PotMatchSet{potMatches[p1], potMatches[p2]},
+                               mapObjInstances,
+                               frameObjInstances,
+                               lineToLineAngThresh,
+                               planeToPlaneAngThresh,
+                               planeToLineAngThresh))
+                {
+                    chunkEdges[c].emplace_back(min(p1, p2), max(p1, p2));
+                }
+            };
             
-            for(int p = 0; p < potMatches.size(); ++p){
-                vector<PotMatch> curSet = potSets[s];
-                curSet.push_back(potMatches[p]);
-//                cout << "matches:" << endl;
-//                for(int ch = 0; ch < curSet.size(); ++ch){
-//                    cout << curSet[ch].plane1 << " " << curSet[ch].plane2 << endl;
-//                }
-                vector<int> curIdxs = potSetsIdxs[s];
-                curIdxs.push_back(p);
-//                sort(curIdxs.begin(), curIdxs.end());
-                for(int i = 0; i < curIdxs.size() - 1; ++i){
-                    for(int j = 0; j < curIdxs.size() - i - 1; ++j){
-                        if(curIdxs[j] > curIdxs[j+1]){
-                            swap(curIdxs[i], curIdxs[j]);
-                        }
+            vector<pair<int, int>> mapPairs;
+            for(int f1 = fBeg; f1 < fEnd; ++f1){
+                for(int f2 = f1 + 1; f2 < numFrameObjs; ++f2){
+                    if(frameNumPotMatches[f1] == 0 || frameNumPotMatches[f2] == 0 ||
+                       frameObjDistances[f1][f2] > planeDistThresh)
+                    {
+                        continue;
                     }
-                }
-                
-                static constexpr int mult = 10000;
-                int curMult = 1;
-                uint64_t curHashValue = 0;
-                for(int i = 0; i < curIdxs.size(); ++i){
-                    curHashValue += curIdxs[i] * curMult;
-                    curMult *= mult;
-                }
-                
-                bool valid = true;
-                // if there was the same combination
-                if(newPotSetsIdxsSet.count(curHashValue) > 0){
-                    valid = false;
-                }
-
-                if(valid) {
-                    set<int> planesMapSet;
-                    set<int> planesFrameSet;
-                    int numPlanePairs = 0;
-                    int numLinePairs = 0;
-                    for (int ch = 0; ch < curSet.size(); ++ch) {
-                        // if same plane is in more than one pair than not valid
-                        if (planesMapSet.count(curSet[ch].plane1) != 0 ||
-                            planesFrameSet.count(curSet[ch].plane2) != 0) {
-                            valid = false;
+                    double frameAng = MapIndex::compNormalAngle(frameObjInstances[f1],
+                                                                frameObjInstances[f2]);
+                    
+                    // either look up compatible map pairs or check map pairs of potential matches,
+                    // depending on which is smaller
+                    size_t numPairsDirect = (size_t)frameNumPotMatches[f1] * frameNumPotMatches[f2];
+                    size_t numPairsIndex = mapIndex->countPairs(frameAng, planeToPlaneAngThresh);
+                    if(numPairsIndex < numPairsDirect){
+                        mapPairs.clear();
+                        mapIndex->findPairs(frameAng,
+                                            planeToPlaneAngThresh,
+                                            planeDistThresh,
+                                            mapPairs);
+                        for(const pair<int, int> &mapPair : mapPairs){
+                            // both assignments of the map pair to the frame pair
+                            for(int o = 0; o < 2; ++o){
+                                int m1 = (o == 0) ? mapPair.first : mapPair.second;
+                                int m2 = (o == 0) ? mapPair.second : mapPair.first;
+                                auto it1 = frameToMapToPotMatch[f1].find(m1);
+                                auto it2 = frameToMapToPotMatch[f2].find(m2);
+                                if(it1 == frameToMapToPotMatch[f1].end() ||
+                                   it2 == frameToMapToPotMatch[f2].end())
+                                {
+                                    continue;
+                                }
+                                for(int p1 : it1->second){
+                                    for(int p2 : it2->second){
+                                        checkEdge(p1, p2);
+                                    }
+                                }
+                            }
                         }
-                        ++numPlanePairs;
-                        numLinePairs += curSet[ch].lineSegs1.size();
-        
-                        planesMapSet.insert(curSet[ch].plane1);
-                        planesFrameSet.insert(curSet[ch].plane2);
                     }
-//                if(ne == 3 && numPlanePairs + numLinePairs < 3){
-//                    valid = false;
-//                }
-                }
-                if(valid){
-                    // if planes are not close enough
-                    for(int p1 = 0; p1 < curSet.size(); ++p1) {
-                        for (int p2 = p1 + 1; p2 < curSet.size(); ++p2) {
-                            int pm1 = curSet[p1].plane1;
-                            int pm2 = curSet[p2].plane1;
-                            if (mapObjDistances[pm1][pm2] > planeDistThresh) {
-                                valid = false;
-                            }
-                            int pf1 = curSet[p1].plane2;
-                            int pf2 = curSet[p2].plane2;
-                            if (frameObjDistances[pf1][pf2] > planeDistThresh) {
-                                valid = false;
+                    else{
+                        for(const pair<const int, vector<int>> &mapPotMatches1 : frameToMapToPotMatch[f1]){
+                            for(const pair<const int, vector<int>> &mapPotMatches2 : frameToMapToPotMatch[f2]){
+                                const MapIndex::Neighbor *nh = mapIndex->findNeighbor(mapPotMatches1.first,
+                                                                                      mapPotMatches2.first);
+                                if(nh == nullptr ||
+                                   nh->dist > planeDistThresh ||
+                                   fabs(nh->ang - frameAng) > planeToPlaneAngThresh)
+                                {
+                                    continue;
+                                }
+                                for(int p1 : mapPotMatches1.second){
+                                    for(int p2 : mapPotMatches2.second){
+                                        checkEdge(p1, p2);
+                                    }
+                                }
                             }
                         }
                     }
                 }
-                if(valid){
-                    // check angles between planes and lines
-
-                    vectorVector4d planesMap;
-                    vectorLineSeg linesMap;
-                    vectorVector4d planesFrame;
-                    vectorLineSeg linesFrame;
-                    for(int ch = 0; ch < curSet.size(); ++ch){
-                        planesMap.push_back(mapObjInstances[curSet[ch].plane1].getNormal());
-                        const vectorLineSeg &allLinesMap = mapObjInstances[curSet[ch].plane1].getLineSegs();
-                        for(int lm = 0; lm < curSet[ch].lineSegs1.size(); ++lm){
-                            linesMap.push_back(allLinesMap[curSet[ch].lineSegs1[lm]]);
-                        }
-
-                        planesFrame.push_back(frameObjInstances[curSet[ch].plane2].getNormal());
-                        const vectorLineSeg &allLinesFrame = frameObjInstances[curSet[ch].plane2].getLineSegs();
-                        for(int lf = 0; lf < curSet[ch].lineSegs2.size(); ++lf){
-                            linesFrame.push_back(allLinesFrame[curSet[ch].lineSegs2[lf]]);
-                        }
-                    }
-
-                    if(!checkLineToLineAng(linesMap, linesFrame, lineToLineAngThresh)){
-                        valid = false;
-                    }
-                    if(!checkPlaneToPlaneAng(planesMap, planesFrame, planeToPlaneAngThresh)){
-                        valid = false;
+            }
+        });
+        
+        for(int c = 0; c < numChunks; ++c){
+            for(const pair<int, int> &edge : chunkEdges[c]){
+                adjacency[edge.first * numWords + edge.second / 64] |= (uint64_t)1 << (edge.second % 64);
+            }
+        }
+    }
+    else {
+        vector<vector<double>> mapObjDistances;
+        compObjDistances(mapObjInstances, mapObjDistances);
+        
+        threadPool.parallelFor(numPotMatches, threadPool.chooseChunkSize(numPotMatches),
+                               [&](int c, int iBeg, int iEnd)
+        {
+            for(int i = iBeg; i < iEnd; ++i){
+                uint64_t *adjRow = adjacency.data() + i * numWords;
+                for(int j = i + 1; j < numPotMatches; ++j){
+                    // if planes are not close enough
+                    if(mapObjDistances[potMatches[i].plane1][potMatches[j].plane1] > planeDistThresh ||
+                       frameObjDistances[potMatches[i].plane2][potMatches[j].plane2] > planeDistThresh)
+                    {
+                        continue;
                     }
-                    if(!checkPlaneToLineAng(planesMap, linesMap, planesFrame, linesFrame, planeToLineAngThresh)){
-                        valid = false;
+                    if(checkPotSet(PotMatchSet{potMatches[i], potMatches[j]},
+                                   mapObjInstances,
+                                   frameObjInstances,
+                                   lineToLineAngThresh,
+                                   planeToPlaneAngThresh,
+                                   planeToLineAngThresh))
+                    {
+                        adjRow[j / 64] |= (uint64_t)1 << (j % 64);
                     }
-                    if(valid) {
-                        newPotSets.push_back(curSet);
-                        newPotSetsIdxs.push_back(curIdxs);
-                        newPotSetsIdxsSet.insert(curHashValue);
+                }
+            }
+        });
+    }
+    
+    // enumerate triplets i < j < k, every set is visited once
+    int chunkSize = threadPool.chooseChunkSize(numPotMatches);
+    int numChunks = ThreadPool::numChunks(numPotMatches, chunkSize);
+    vector<vector<PotSetIdxs> > chunkPotSets(numChunks);
+    
+    threadPool.parallelFor(numPotMatches, chunkSize, [&](int c, int iBeg, int iEnd){
+        for(int i = iBeg; i < iEnd; ++i) {
+            const uint64_t *adjRowI = adjacency.data() + i * numWords;
+            for(int wj = 0; wj < numWords; ++wj) {
+                uint64_t bitsJ = adjRowI[wj];
+                while(bitsJ) {
+                    int j = wj * 64 + __builtin_ctzll(bitsJ);
+                    bitsJ &= bitsJ - 1;
+                    
+                    // row j contains only k > j
+                    const uint64_t *adjRowJ = adjacency.data() + j * numWords;
+                    for(int wk = j / 64; wk < numWords; ++wk) {
+                        uint64_t bitsK = adjRowI[wk] & adjRowJ[wk];
+                        while(bitsK) {
+                            int k = wk * 64 + __builtin_ctzll(bitsK);
+                            bitsK &= bitsK - 1;
+                            
+                            chunkPotSets[c].push_back(PotSetIdxs{i, j, k});
+                        }
                     }
                 }
             }
         }
-        
-        potSets.swap(newPotSets);
-        potSetsIdxs.swap(newPotSetsIdxs);
+    });
+    
+    for(int c = 0; c < numChunks; ++c){
+        potSets.insert(potSets.end(),
+                       chunkPotSets[c].begin(),
+                       chunkPotSets[c].end());
     }
     
 //    vector<vector<PotMatch> > potSetsComp;
@@ -1186,17 +1968,80 @@ vector<vector<Matching::PotMatch>> Matching::findPotSets(const vector<PotMatch>
     return potSets;
 }
 
-void Matching::compObjFeatures(const vectorObjInstance& objInstances,
-							std::vector<cv::Mat>& objFeats)
+Matching::VerifStats &Matching::VerifStats::operator+=(const VerifStats &other) {
+    numVerified += other.numVerified;
+    numSprtRejected += other.numSprtRejected;
+    numSprtPassed += other.numSprtPassed;
+    numSprtUndecided += other.numSprtUndecided;
+    numSprtSamples += other.numSprtSamples;
+    numScored += other.numScored;
+    numAccepted += other.numAccepted;
+    return *this;
+}
+
+Matching::PotMatchSet Matching::getPotMatchSet(const std::vector<PotMatch> &potMatches,
+                                               const PotSetIdxs &potSet)
 {
-	for(int o = 0; o < objInstances.size(); ++o){
-		objFeats.push_back(objInstances[o].getColorHist());
-	}
+    PotMatchSet potMatchSet;
+    for(int p : potSet){
+        potMatchSet.push_back(potMatches[p]);
+    }
+    return potMatchSet;
 }
 
+bool Matching::checkPotSet(const PotMatchSet &curSet,
+                           const vectorObjInstance &mapObjInstances,
+                           const vectorObjInstance &frameObjInstances,
+                           double lineToLineAngThresh,
+                           double planeToPlaneAngThresh,
+                           double planeToLineAngThresh)
+{
+    for (int p1 = 0; p1 < curSet.size(); ++p1) {
+        for (int p2 = p1 + 1; p2 < curSet.size(); ++p2) {
+            // if same plane is in more than one pair than not valid
+            if (curSet[p1].plane1 == curSet[p2].plane1 ||
+                curSet[p1].plane2 == curSet[p2].plane2)
+            {
+                return false;
+            }
+        }
+    }
+    
+    // check angles between planes and lines
+    vectorVector4d planesMap;
+    vectorLineSeg linesMap;
+    vectorVector4d planesFrame;
+    vectorLineSeg linesFrame;
+    for(int ch = 0; ch < curSet.size(); ++ch){
+        planesMap.push_back(mapObjInstances[curSet[ch].plane1].getNormal());
+        const vectorLineSeg &allLinesMap = mapObjInstances[curSet[ch].plane1].getLineSegs();
+        for(int lm = 0; lm < curSet[ch].lineSegs1.size(); ++lm){
+            linesMap.push_back(allLinesMap[curSet[ch].lineSegs1[lm]]);
+        }
+        
+        planesFrame.push_back(frameObjInstances[curSet[ch].plane2].getNormal());
+        const vectorLineSeg &allLinesFrame = frameObjInstances[curSet[ch].plane2].getLineSegs();
+        for(int lf = 0; lf < curSet[ch].lineSegs2.size(); ++lf){
+            linesFrame.push_back(allLinesFrame[curSet[ch].lineSegs2[lf]]);
+        }
+    }
+    
+    if(!checkLineToLineAng(linesMap, linesFrame, lineToLineAngThresh)){
+        return false;
+    }
+    if(!checkPlaneToPlaneAng(planesMap, planesFrame, planeToPlaneAngThresh)){
+        return false;
+    }
+    if(!checkPlaneToLineAng(planesMap, linesMap, planesFrame, linesFrame, planeToLineAngThresh)){
+        return false;
+    }
+    
+    return true;
+}
 
 void Matching::compObjDistances(const vectorObjInstance& objInstances,
-                                std::vector<std::vector<double>>& objDistances)
+                                std::vector<std::vector<double>>& objDistances,
+                                MatchingCache *cache)
 {
     objDistances.resize(objInstances.size(), vector<double>(objInstances.size(), 0));
 //    cout << "objDistances.size() = " << objDistances.size()
@@ -1205,7 +2050,13 @@ void Matching::compObjDistances(const vectorObjInstance& objInstances,
 //        cout << "o1 = " << o1 << endl;
         for(int o2 = o1 + 1; o2 < objInstances.size(); ++o2){
 //            cout << "o2 = " << o2 << endl;
-            double minDist = objInstances[o1].getHull().minDistance(objInstances[o2].getHull());
+            double minDist = 0.0;
+            if(!cache || !cache->findDistance(objInstances[o1], objInstances[o2], minDist)){
+                minDist = objInstances[o1].getHull().minDistance(objInstances[o2].getHull());
+                if(cache){
+                    cache->insertDistance(objInstances[o1], objInstances[o2], minDist);
+                }
+            }
 //			cout << "o1 = " << o1 << ", o2 = " << o2 << endl;
             objDistances[o1][o2] = minDist;
             objDistances[o2][o1] = minDist;
@@ -1699,6 +2550,7 @@ double Matching::scoreTransformByProjection(const Vector7d& transform,
 											std::vector<double>& intAreaPair,
                                             double intAreaThresh,
                                             double planeEqDiffThresh,
+                                            const ConcaveHull::IntersectParams &hullIntersect,
 											pcl::visualization::PCLVisualizer::Ptr viewer,
 											int viewPort1,
 											int viewPort2)
@@ -1729,6 +2581,7 @@ double Matching::scoreTransformByProjection(const Vector7d& transform,
                                                             obj2,
                                                             transform,
                                                             curIntArea,
+                                                            hullIntersect,
                                                             viewer,
                                                             viewPort1,
                                                             viewPort2);
@@ -1759,15 +2612,16 @@ double Matching::scoreTransformByProjection(const Vector7d& transform,
 }
 
 double Matching::scoreTransformByProjection(const Vector7d &transform,
-                                            const vector<PotMatch> curSet,
+                                            const PotMatchSet &curSet,
                                             const vectorObjInstance &objInstances1,
                                             const vectorObjInstance &objInstances2,
-                                            std::vector<double> &intAreaPlanes,
-                                            std::vector<std::vector<double> > &intLenLines,
+                                            PlaneVals &intAreaPlanes,
+                                            PlaneLineVals &intLenLines,
                                             double planeEqDiffThresh,
                                             double lineEqDiffThresh,
                                             double intAreaThresh,
                                             double intLenThresh,
+                                            const ConcaveHull::IntersectParams &hullIntersect,
                                             pcl::visualization::PCLVisualizer::Ptr viewer,
                                             int viewPort1,
                                             int viewPort2)
@@ -1825,7 +2679,7 @@ double Matching::scoreTransformByProjection(const Vector7d &transform,
             if(curValid) {
                 // test line segments intersection
                 
-                intLenLines.push_back(vector<double>());
+                intLenLines.push_back(LineVals());
                 for(int l = 0; l < curSet[ch].lineSegs1.size() && curValid; ++l) {
                     const LineSeg &line1 = obj1.getLineSegs()[curSet[ch].lineSegs1[l]];
                     const LineSeg &line2 = obj2.getLineSegs()[curSet[ch].lineSegs2[l]];
@@ -1850,6 +2704,7 @@ double Matching::scoreTransformByProjection(const Vector7d &transform,
                                                                     obj2,
                                                                     transform,
                                                                     curIntArea,
+                                                                    hullIntersect,
                                                                     viewer,
                                                                     viewPort1,
                                                                     viewPort2);
@@ -1884,6 +2739,65 @@ double Matching::scoreTransformByProjection(const Vector7d &transform,
     }
 }
 
+bool Matching::checkSprt(const Vector7d &transform,
+                         const PotMatchSet &curSet,
+                         const vectorVector4d &mapPlanes,
+                         const vectorVector4d &framePlanes,
+                         const std::vector<int> &frameOrder,
+                         const SprtParams &sprtParams,
+                         int &decision,
+                         int &numSamples)
+{
+    // log likelihood ratio increments for agreeing and not agreeing planes
+    double llrAgree = log(sprtParams.pCorrect / sprtParams.pWrong);
+    double llrDisagree = log((1.0 - sprtParams.pCorrect) / (1.0 - sprtParams.pWrong));
+    double lowerBound = sprtParams.lowerBound();
+    double upperBound = sprtParams.upperBound();
+    double cosAngThresh = cos(sprtParams.angThresh);
+    
+    // frame planes to the map
+    Eigen::Matrix4d Tinvt = g2o::SE3Quat(transform).to_homogeneous_matrix().inverse().transpose();
+    
+    double llr = 0.0;
+    decision = 0;
+    numSamples = 0;
+    for(int of : frameOrder){
+        bool inSet = false;
+        for(int p = 0; p < curSet.size(); ++p){
+            if(curSet[p].plane2 == of){
+                inSet = true;
+            }
+        }
+        if(inSet){
+            continue;
+        }
+        
+        Eigen::Vector4d framePlaneTrans = Tinvt * framePlanes[of];
+        
+        bool agree = false;
+        for(int om = 0; om < mapPlanes.size() && !agree; ++om){
+            if(framePlaneTrans.head<3>().dot(mapPlanes[om].head<3>()) > cosAngThresh &&
+               fabs(framePlaneTrans(3) - mapPlanes[om](3)) < sprtParams.distThresh)
+            {
+                agree = true;
+            }
+        }
+        
+        ++numSamples;
+        llr += agree ? llrAgree : llrDisagree;
+        if(llr <= lowerBound){
+            decision = -1;
+            return false;
+        }
+        if(llr >= upperBound){
+            decision = 1;
+            return true;
+        }
+    }
+    // not enough evidence to reject
+    return true;
+}
+
 double Matching::planeEqDiffLogMap(const ObjInstance &obj1,
                                    const ObjInstance &obj2,
                                    const Vector7d &transform)
@@ -1919,6 +2833,7 @@ double Matching::checkConvexHullIntersection(const ObjInstance& obj1,
                                             const ObjInstance& obj2,
                                             const Vector7d& transform,
                                              double& intArea,
+                                             const ConcaveHull::IntersectParams &hullIntersect,
                                              pcl::visualization::PCLVisualizer::Ptr viewer,
                                              int viewPort1,
                                              int viewPort2)
@@ -1932,11 +2847,17 @@ double Matching::checkConvexHullIntersection(const ObjInstance& obj1,
     const ConcaveHull &obj1Hull = obj1.getHull();
     const ConcaveHull &obj2Hull = obj2.getHull();
     
-    ConcaveHull obj1HullTrans = obj1Hull.transform(transformInv);
-    
-    ConcaveHull interHull = obj2Hull.intersect(obj1HullTrans, 0.0);
-    
-    intArea = interHull.getTotalArea();
+    // polygons of the transformed hull and of the intersection are only needed for display
+    ConcaveHull obj1HullTrans;
+    ConcaveHull interHull;
+    if(viewer){
+        obj1HullTrans = obj1Hull.transform(transformInv);
+        interHull = obj2Hull.intersect(obj1HullTrans, 0.0);
+        intArea = interHull.getTotalArea();
+    }
+    else{
+        intArea = obj2Hull.intersectArea(obj1Hull, transformInv, hullIntersect);
+    }
     
 
 //    double iou = intArea/(curPl1ChullArea + curPl2ChullArea - intArea);
@@ -2004,14 +2925,78 @@ double Matching::checkLineSegIntersection(const LineSeg &lineSeg1,
     return intScore;
 }
 
-double Matching::evalPoint(const Vector7d &pt,
-                           const vectorProbDistKernel &dist)
+std::vector<Matching::PotMatch> Matching::filterPotMatches(const std::vector<PotMatch> &potMatches,
+                                                           const vectorObjInstance &mapObjInstances,
+                                                           const vectorObjInstance &frameObjInstances,
+                                                           const PosePrior &posePrior,
+                                                           double planeToPlaneAngThresh)
 {
-	double res = 0.0;
-	for(int k = 0; k < dist.size(); ++k){
-		res += dist[k].eval(pt);
-	}
-	return res;
+    g2o::SE3Quat poseSE3Quat(posePrior.pose);
+    Eigen::Matrix3d R = poseSE3Quat.rotation().toRotationMatrix();
+    Eigen::Vector3d t = poseSE3Quat.translation();
+    
+    // standard deviations along the least certain directions
+    double sigmaRot = sqrt(max(Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d>(posePrior.covar.block<3, 3>(0, 0)).eigenvalues()(2), 0.0));
+    double sigmaTrans = sqrt(max(Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d>(posePrior.covar.block<3, 3>(3, 3)).eigenvalues()(2), 0.0));
+    double k = sqrt(posePrior.chi2Thresh);
+    double angThresh = planeToPlaneAngThresh + k * sigmaRot;
+    double normDotThresh = angThresh < M_PI ? cos(angThresh) : -1.0;
+    
+    // bounding spheres of hulls, centered at centroids of planes
+    auto compBoundingSphere = [](const ObjInstance &obj, Eigen::Vector3d &center, double &radius){
+        center = obj.getPlaneEstimator().getCentroid();
+        radius = 0.0;
+        for(const pcl::PointCloud<pcl::PointXYZRGB>::Ptr &poly : obj.getHull().getPolygons3d()){
+            for(const pcl::PointXYZRGB &pt : poly->points){
+                radius = max(radius, (pt.getVector3fMap().cast<double>() - center).norm());
+            }
+        }
+    };
+    
+    vectorVector3d mapCenters(mapObjInstances.size());
+    vector<double> mapRadii(mapObjInstances.size(), -1.0);
+    vectorVector3d frameCenters(frameObjInstances.size());
+    vectorVector3d frameCentersTrans(frameObjInstances.size());
+    vector<double> frameRadii(frameObjInstances.size(), -1.0);
+    
+    vector<PotMatch> retPotMatches;
+    for(const PotMatch &pm : potMatches){
+        int om = pm.plane1;
+        int of = pm.plane2;
+        if(mapRadii[om] < 0.0){
+            compBoundingSphere(mapObjInstances[om], mapCenters[om], mapRadii[om]);
+        }
+        if(frameRadii[of] < 0.0){
+            compBoundingSphere(frameObjInstances[of], frameCenters[of], frameRadii[of]);
+            frameCentersTrans[of] = R * frameCenters[of] + t;
+        }
+        
+        Eigen::Vector3d frameNormalTrans = R * frameObjInstances[of].getNormal().head<3>();
+        if(frameNormalTrans.dot(mapObjInstances[om].getNormal().head<3>()) < normDotThresh){
+            continue;
+        }
+        
+        // error of rotation moves points proportionally to their distance from the origin of the frame
+        double margin = k * (sigmaTrans + sigmaRot * (frameCenters[of].norm() + frameRadii[of]));
+        double centerDist = (frameCentersTrans[of] - mapCenters[om]).norm();
+        if(centerDist > mapRadii[om] + frameRadii[of] + margin){
+            continue;
+        }
+        
+        retPotMatches.push_back(pm);
+    }
+    cout << "pose prior kept " << retPotMatches.size() << " of " << potMatches.size() << " potential matches" << endl;
+    
+    return retPotMatches;
+}
+
+bool Matching::checkPosePrior(const Vector7d &transform,
+                              const PosePrior &posePrior)
+{
+    g2o::SE3Quat diff = g2o::SE3Quat(posePrior.pose).inverse() * g2o::SE3Quat(transform);
+    Vector6d logMapDiff = diff.log();
+    double dist = logMapDiff.transpose() * posePrior.infMat * logMapDiff;
+    return dist < posePrior.chi2Thresh;
 }
 
 int Matching::countDifferent(const std::set<int> &setIdxs, const vectorObjInstance &objs) {
@@ -2041,22 +3026,3 @@ int Matching::countDifferent(const std::set<int> &setIdxs, const vectorObjInstan
     return finalSetIdxs.size();
 }
 
-Matching::ProbDistKernel::ProbDistKernel(Vector7d ikPt,
-										Eigen::Matrix<double, 6, 6> iinfMat,
-										double iweight)
-	:
-	kPt(ikPt),
-	infMat(iinfMat),
-	weight(iweight),
-	kPtSE3Quat(ikPt)
-{
-
-}
-
-double Matching::ProbDistKernel::eval(Vector7d pt) const
-{
-	g2o::SE3Quat ptSE3Quat(pt);
-	Vector6d diff = (ptSE3Quat.inverse() * kPtSE3Quat).log();
-	double res = weight * exp(-diff.transpose() * infMat * diff);
-	return res;
-}
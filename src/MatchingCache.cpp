@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <set>
+
+#include "MatchingCache.hpp"
+
+using namespace std;
+
+MatchingCache::MatchingCache()
+    : numHits(0),
+      numMisses(0)
+{}
+
+void MatchingCache::prepare(const vectorObjInstance &mapObjInstances,
+                            const std::vector<double> &newParams)
+{
+    vector<ObjKey> newMapKeys;
+    for(const ObjInstance &obj : mapObjInstances){
+        newMapKeys.push_back(getKey(obj));
+    }
+    if(newMapKeys != mapKeys || newParams != params){
+        clear();
+        mapKeys.swap(newMapKeys);
+        params = newParams;
+    }
+    numHits = 0;
+    numMisses = 0;
+}
+
+void MatchingCache::retain(const vectorObjInstance &frameObjInstances) {
+    set<ObjKey> frameKeys;
+    for(const ObjInstance &obj : frameObjInstances){
+        frameKeys.insert(getKey(obj));
+    }
+    for(auto it = potMatches.begin(); it != potMatches.end(); ){
+        if(frameKeys.count(it->first) == 0){
+            it = potMatches.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+    for(auto it = distances.begin(); it != distances.end(); ){
+        if(frameKeys.count(it->first.first) == 0 || frameKeys.count(it->first.second) == 0){
+            it = distances.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+}
+
+const std::vector<Matching::PotMatch> *MatchingCache::findPotMatches(const ObjInstance &obj) {
+    auto it = potMatches.find(getKey(obj));
+    if(it == potMatches.end()){
+        ++numMisses;
+        return nullptr;
+    }
+    ++numHits;
+    return &(it->second);
+}
+
+void MatchingCache::insertPotMatches(const ObjInstance &obj,
+                                     const std::vector<Matching::PotMatch> &objPotMatches)
+{
+    potMatches[getKey(obj)] = objPotMatches;
+}
+
+bool MatchingCache::findDistance(const ObjInstance &obj1,
+                                 const ObjInstance &obj2,
+                                 double &dist)
+{
+    auto it = distances.find(getPairKey(obj1, obj2));
+    if(it == distances.end()){
+        ++numMisses;
+        return false;
+    }
+    ++numHits;
+    dist = it->second;
+    return true;
+}
+
+void MatchingCache::insertDistance(const ObjInstance &obj1,
+                                   const ObjInstance &obj2,
+                                   double dist)
+{
+    distances[getPairKey(obj1, obj2)] = dist;
+}
+
+MatchingCache::ObjKey MatchingCache::getKey(const ObjInstance &obj) {
+    return ObjKey(obj.getId(), obj.getVersion());
+}
+
+std::pair<MatchingCache::ObjKey, MatchingCache::ObjKey> MatchingCache::getPairKey(const ObjInstance &obj1,
+                                                                                  const ObjInstance &obj2)
+{
+    ObjKey key1 = getKey(obj1);
+    ObjKey key2 = getKey(obj2);
+    if(key2 < key1){
+        swap(key1, key2);
+    }
+    return make_pair(key1, key2);
+}
+
+void MatchingCache::clear() {
+    potMatches.clear();
+    distances.clear();
+}
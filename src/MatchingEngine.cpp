@@ -0,0 +1,148 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <iostream>
+
+#include "MatchingEngine.hpp"
+
+using namespace std;
+
+MatchingEngine::MatchingEngine(const Matching::Settings &settings,
+                               const vectorObjInstance &mapObjInstances,
+                               const MapIndex *mapIndex)
+    : settings(settings),
+      threadPool(settings.numThreads)
+{
+    addShard(mapObjInstances, mapIndex);
+}
+
+MatchingEngine::MatchingEngine(const Matching::Settings &settings,
+                               const std::vector<vectorObjInstance> &shardObjInstances)
+    : settings(settings),
+      threadPool(settings.numThreads)
+{
+    for(const vectorObjInstance &objInstances : shardObjInstances){
+        addShard(objInstances);
+    }
+}
+
+int MatchingEngine::addShard(const vectorObjInstance &objInstances,
+                             const MapIndex *index,
+                             bool buildIndex)
+{
+    unique_ptr<MapIndex> ownIndex;
+    if(index && !index->isValidFor(objInstances)){
+        index = nullptr;
+    }
+    if(!index && buildIndex){
+        cout << "building index of shard " << mapShards.size() << endl;
+        ownIndex.reset(new MapIndex());
+        ownIndex->build(objInstances,
+                        settings.planeDistThresh,
+                        settings.indexAngBinSize,
+                        settings.indexDistBinSize,
+                        threadPool);
+        index = ownIndex.get();
+    }
+    // map hulls are read by concurrent match() calls and the lazy kernel computes exact values
+    // on first use, so they are computed once here
+    for(const ObjInstance &obj : objInstances){
+        obj.getHull().computeExact();
+    }
+    mapShards.emplace_back(&objInstances, index);
+    ownMapIndices.push_back(move(ownIndex));
+    
+    return mapShards.size() - 1;
+}
+
+void MatchingEngine::removeShard(int shardIdx) {
+    mapShards.erase(mapShards.begin() + shardIdx);
+    ownMapIndices.erase(ownMapIndices.begin() + shardIdx);
+}
+
+Matching::MatchType MatchingEngine::match(const vectorObjInstance &frameObjInstances,
+                                          const Matching::MatchOptions &options,
+                                          Matching::MatchResult &result,
+                                          pcl::visualization::PCLVisualizer::Ptr viewer,
+                                          int viewPort1,
+                                          int viewPort2)
+{
+    unique_ptr<Matching::Scratch> scratch = acquireScratch();
+    Matching::Stats callStats;
+    Matching::MatchType matchType = Matching::matchFrameToShards(settings,
+                                                                 threadPool,
+                                                                 *scratch,
+                                                                 callStats,
+                                                                 frameObjInstances,
+                                                                 mapShards,
+                                                                 options,
+                                                                 result,
+                                                                 viewer,
+                                                                 viewPort1,
+                                                                 viewPort2);
+    release(move(scratch), callStats);
+    return matchType;
+}
+
+void MatchingEngine::matchFramesToMap(const std::vector<vectorObjInstance> &frames,
+                                      const std::function<void(const FrameResult &)> &callback)
+{
+    mutex callbackMutex;
+    // one frame per chunk - frames differ a lot in cost, matching of a single frame
+    // is parallelized as well, so idle threads steal its chunks
+    threadPool.parallelFor(frames.size(), 1, [&](int c, int beg, int end){
+        for(int f = beg; f < end; ++f){
+            FrameResult frameResult;
+            frameResult.frameIdx = f;
+            frameResult.matchType = match(frames[f],
+                                          Matching::MatchOptions(),
+                                          frameResult.result);
+            
+            unique_lock<mutex> lock(callbackMutex);
+            callback(frameResult);
+        }
+    });
+}
+
+Matching::Stats MatchingEngine::getStats() const {
+    unique_lock<std::mutex> lock(engineMutex);
+    return stats;
+}
+
+std::unique_ptr<Matching::Scratch> MatchingEngine::acquireScratch() {
+    unique_lock<std::mutex> lock(engineMutex);
+    if(freeScratches.empty()){
+        return unique_ptr<Matching::Scratch>(new Matching::Scratch());
+    }
+    unique_ptr<Matching::Scratch> scratch = move(freeScratches.back());
+    freeScratches.pop_back();
+    return scratch;
+}
+
+void MatchingEngine::release(std::unique_ptr<Matching::Scratch> scratch,
+                             const Matching::Stats &callStats)
+{
+    unique_lock<std::mutex> lock(engineMutex);
+    freeScratches.push_back(move(scratch));
+    stats += callStats;
+}
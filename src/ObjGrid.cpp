@@ -0,0 +1,154 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "ObjGrid.hpp"
+
+using namespace std;
+
+// 21 bits for every coordinate of a cell
+static int64_t cellKey(int64_t x, int64_t y, int64_t z){
+    static constexpr int64_t mask = (int64_t(1) << 21) - 1;
+    return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
+}
+
+ObjGrid::ObjGrid()
+    : cellSize(1.0),
+      margin(0.1),
+      normalDotThresh(0.707)
+{}
+
+ObjGrid::ObjGrid(double cellSize,
+                 double margin,
+                 double normalDotThresh)
+    : cellSize(cellSize),
+      margin(margin),
+      normalDotThresh(normalDotThresh)
+{}
+
+void ObjGrid::insert(const ObjInstance &obj) {
+    Entry entry;
+    entry.normal = obj.getNormal().head<3>();
+    compBoundingBox(obj, entry.minPt, entry.maxPt);
+    compCells(entry.minPt, entry.maxPt, entry.cells);
+    
+    for(int64_t cell : entry.cells){
+        cells[cell].push_back(obj.getId());
+    }
+    entries[obj.getId()] = entry;
+}
+
+void ObjGrid::remove(int id) {
+    auto it = entries.find(id);
+    if(it == entries.end()){
+        return;
+    }
+    for(int64_t cell : it->second.cells){
+        vector<int> &cellIds = cells[cell];
+        cellIds.erase(find(cellIds.begin(), cellIds.end(), id));
+        if(cellIds.empty()){
+            cells.erase(cell);
+        }
+    }
+    entries.erase(it);
+}
+
+void ObjGrid::update(const ObjInstance &obj) {
+    remove(obj.getId());
+    insert(obj);
+}
+
+void ObjGrid::clear() {
+    entries.clear();
+    cells.clear();
+}
+
+std::vector<int> ObjGrid::getCandidates(const ObjInstance &obj) const {
+    Eigen::Vector3d normal = obj.getNormal().head<3>();
+    Eigen::Vector3d minPt, maxPt;
+    compBoundingBox(obj, minPt, maxPt);
+    minPt -= Eigen::Vector3d::Constant(margin);
+    maxPt += Eigen::Vector3d::Constant(margin);
+    
+    vector<int64_t> queryCells;
+    compCells(minPt, maxPt, queryCells);
+    
+    vector<int> candidates;
+    for(int64_t cell : queryCells){
+        auto it = cells.find(cell);
+        if(it != cells.end()){
+            candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+    
+    vector<int> retCandidates;
+    for(int id : candidates){
+        const Entry &entry = entries.at(id);
+        bool boxesOverlap = (entry.minPt.array() <= maxPt.array()).all() &&
+                            (minPt.array() <= entry.maxPt.array()).all();
+        if(boxesOverlap && entry.normal.dot(normal) > normalDotThresh){
+            retCandidates.push_back(id);
+        }
+    }
+    return retCandidates;
+}
+
+void ObjGrid::compBoundingBox(const ObjInstance &obj,
+                              Eigen::Vector3d &minPt,
+                              Eigen::Vector3d &maxPt)
+{
+    minPt = Eigen::Vector3d::Constant(numeric_limits<double>::max());
+    maxPt = Eigen::Vector3d::Constant(-numeric_limits<double>::max());
+    for(const pcl::PointCloud<pcl::PointXYZRGB>::Ptr &poly3d : obj.getHull().getPolygons3d()){
+        for(auto it = poly3d->begin(); it != poly3d->end(); ++it){
+            Eigen::Vector3d pt = it->getVector3fMap().cast<double>();
+            minPt = minPt.cwiseMin(pt);
+            maxPt = maxPt.cwiseMax(pt);
+        }
+    }
+    // objects without a hull are represented by their centroid
+    if((maxPt.array() < minPt.array()).any()){
+        minPt = obj.getPlaneEstimator().getCentroid();
+        maxPt = minPt;
+    }
+}
+
+void ObjGrid::compCells(const Eigen::Vector3d &minPt,
+                        const Eigen::Vector3d &maxPt,
+                        std::vector<int64_t> &retCells) const
+{
+    Eigen::Vector3i minCell = (minPt / cellSize).array().floor().cast<int>();
+    Eigen::Vector3i maxCell = (maxPt / cellSize).array().floor().cast<int>();
+    for(int x = minCell(0); x <= maxCell(0); ++x){
+        for(int y = minCell(1); y <= maxCell(1); ++y){
+            for(int z = minCell(2); z <= maxCell(2); ++z){
+                retCells.push_back(cellKey(x, y, z));
+            }
+        }
+    }
+}
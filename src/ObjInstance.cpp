@@ -25,6 +25,7 @@
 #include <chrono>
 #include <vector>
 #include <list>
+#include <atomic>
 
 //#include <pcl/sample_consensus/model_types.h>
 #include <pcl/filters/project_inliers.h>
@@ -40,7 +41,7 @@
 
 using namespace std;
 
-ObjInstance::ObjInstance() : id(-1) {}
+ObjInstance::ObjInstance() : id(-1), objVersion(newVersion()) {}
 
 ObjInstance::ObjInstance(int iid,
 					ObjType itype,
@@ -54,7 +55,8 @@ ObjInstance::ObjInstance(int iid,
       hull(new ConcaveHull()),
       eolCnt(ieol),
       obsCnt(1),
-      trial(false)
+      trial(false),
+      objVersion(newVersion())
 {
     {
         Eigen::MatrixXd pts(4, points->size());
@@ -123,20 +125,44 @@ ObjInstance::ObjInstance(const ObjInstance &other)
     eolCnt = other.eolCnt;
     obsCnt = other.obsCnt;
     trial = other.trial;
+    // the same content
+    objVersion = other.objVersion;
 }
 
 bool ObjInstance::isMatching(const ObjInstance &other,
+                             const ConcaveHull::IntersectParams &hullIntersect,
                              pcl::visualization::PCLVisualizer::Ptr viewer,
                              int viewPort1,
                              int viewPort2) const
 {
-    double normDot = normal.head<3>().dot(other.getNormal().head<3>());
+    Vector7d transform;
+    // identity
+    transform << 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0;
+    return isMatching(other, transform, hullIntersect, viewer, viewPort1, viewPort2);
+}
+
+bool ObjInstance::isMatching(const ObjInstance &other,
+                             const Vector7d &transform,
+                             const ConcaveHull::IntersectParams &hullIntersect,
+                             pcl::visualization::PCLVisualizer::Ptr viewer,
+                             int viewPort1,
+                             int viewPort2) const
+{
+    g2o::SE3Quat transformSE3Quat(transform);
+    Eigen::Matrix4d transformMat = transformSE3Quat.to_homogeneous_matrix();
+    Eigen::Matrix3d R = transformMat.block<3, 3>(0, 0);
+    
+    Eigen::Vector3d normalTrans = R * normal.head<3>();
+    double normDot = normalTrans.dot(other.getNormal().head<3>());
 //            cout << "normDot = " << normDot << endl;
     // if the faces are roughly oriented in the same direction
     if (normDot > 0.707) {
+        // only fixed size members, so no allocation
+        PlaneEstimator planeEstimatorTrans = planeEstimator;
+        planeEstimatorTrans.transform(transform);
         
-        double dist1 = planeEstimator.distance(other.getPlaneEstimator());
-        double dist2 = other.getPlaneEstimator().distance(planeEstimator);
+        double dist1 = planeEstimatorTrans.distance(other.getPlaneEstimator());
+        double dist2 = other.getPlaneEstimator().distance(planeEstimatorTrans);
         //            double dist1 = mapObj.getEkf().distance(newObj.getEkf().getX());
         //            double dist2 = newObj.getEkf().distance(mapObj.getEkf().getX());
 //                cout << "dist1 = " << dist1 << endl;
@@ -160,14 +186,15 @@ bool ObjInstance::isMatching(const ObjInstance &other,
                     hull->cleanDisplay(viewer, viewPort1);
                     other.getHull().cleanDisplay(viewer, viewPort2);
                 }
-    
-                Vector7d transform;
-                // identity
-                transform << 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0;
+                
+                // the hull of this object is intersected in the frame of the other one,
+                // which for the identity is the same as in merging without a transform
+                Vector7d transformInv = transformSE3Quat.inverse().toVector();
                 double intScore = Matching::checkConvexHullIntersection(*this,
                                                                         other,
-                                                                        transform,
+                                                                        transformInv,
                                                                         intArea,
+                                                                        hullIntersect,
                                                                         viewer,
                                                                         viewPort1,
                                                                         viewPort2);
@@ -231,9 +258,12 @@ void ObjInstance::merge(const ObjInstance &other) {
     compColorHist();
 
     obsCnt += 1;
+    objVersion = newVersion();
 }
 
 void ObjInstance::transform(const Vector7d &transform) {
+    objVersion = newVersion();
+    
     g2o::SE3Quat transformSE3Quat(transform);
     Eigen::Matrix4d transformMat = transformSE3Quat.to_homogeneous_matrix();
     Eigen::Matrix3d R = transformMat.block<3, 3>(0, 0);
@@ -283,6 +313,11 @@ void ObjInstance::transform(const Vector7d &transform) {
 
 
 
+uint64_t ObjInstance::newVersion() {
+    static atomic<uint64_t> nextVersion(0);
+    return nextVersion++;
+}
+
 void ObjInstance::correctOrient() {
     bool corrOrient = true;
     int corrCnt = 0;
@@ -372,8 +407,72 @@ void ObjInstance::compColorHist() {
 
 double ObjInstance::compHistDist(cv::Mat hist1, cv::Mat hist2) {
 //            double histDist = cv::compareHist(frameObjFeats[of], mapObjFeats[om], cv::HISTCMP_CHISQR);
-    cv::Mat histDiff = cv::abs(hist1 - hist2);
-    return cv::sum(histDiff)[0];
+    // no temporary matrices
+    return cv::norm(hist1, hist2, cv::NORM_L1);
+}
+
+void ObjInstance::compHistDistMatrix(const HistMatrix &hists1,
+                                     const HistMatrix &hists2,
+                                     Eigen::MatrixXf &dists)
+{
+    // rows of hists2 are processed in blocks that fit in L1 cache,
+    // fixed number of columns lets Eigen vectorize the inner loop
+    static constexpr int blockRows = 32;
+    
+    dists.resize(hists1.rows(), hists2.rows());
+    for(int b = 0; b < hists2.rows(); b += blockRows){
+        int bEnd = std::min(b + blockRows, (int)hists2.rows());
+        for(int r1 = 0; r1 < hists1.rows(); ++r1){
+            for(int r2 = b; r2 < bEnd; ++r2){
+                dists(r1, r2) = (hists1.row(r1) - hists2.row(r2)).cwiseAbs().sum();
+            }
+        }
+    }
+}
+
+ObjInstance::Descriptor ObjInstance::compDescriptor() const {
+    Descriptor desc;
+    
+    desc.area = hull->getTotalArea();
+    
+    // plane estimator is kept up to date when objects are merged
+    const Eigen::Vector3d &evals = planeEstimator.getEvals();
+    int npts = std::max(planeEstimator.getNpts(), 1);
+    desc.extents << sqrt(std::max(evals(0), 0.0) / npts),
+                    sqrt(std::max(evals(1), 0.0) / npts);
+    double evalsSum = evals.sum();
+    desc.curv = evalsSum > 0.0 ? evals(2) / evalsSum : 0.0;
+    
+    for(int cb = 0; cb < coarseHistBins; ++cb){
+        desc.coarseHist(cb) = 0.0f;
+        for(int b = 4 * cb; b < 4 * (cb + 1); ++b){
+            desc.coarseHist(cb) += colorHist.at<float>(b);
+        }
+    }
+    
+    return desc;
+}
+
+bool ObjInstance::checkDescriptors(const Descriptor &frameDesc,
+                                   const Descriptor &mapDesc,
+                                   const DescriptorThresh &thresh)
+{
+    if(thresh.maxCurvDiff > 0.0 && fabs(frameDesc.curv - mapDesc.curv) > thresh.maxCurvDiff){
+        return false;
+    }
+    if(thresh.maxAreaRatio > 0.0 && frameDesc.area > thresh.maxAreaRatio * mapDesc.area){
+        return false;
+    }
+    if(thresh.maxExtRatio > 0.0 &&
+       (frameDesc.extents(0) > thresh.maxExtRatio * mapDesc.extents(0) ||
+        frameDesc.extents(1) > thresh.maxExtRatio * mapDesc.extents(1)))
+    {
+        return false;
+    }
+    if((frameDesc.coarseHist - mapDesc.coarseHist).cwiseAbs().sum() > thresh.maxHistDist){
+        return false;
+    }
+    return true;
 }
 
 void
@@ -48,6 +48,7 @@
 #include "PlaneSlam.hpp"
 #include "Misc.hpp"
 #include "Matching.hpp"
+#include "MatchingEngine.hpp"
 #include "PlaneSegmentation.hpp"
 #include "Serialization.hpp"
 #include "ConcaveHull.hpp"
@@ -98,6 +99,19 @@ void PlaneSlam::run(){
     for(auto it = map.begin(); it != map.end(); ++it){
 		mapObjInstances.push_back(*it);
 	}
+    
+    // settings parsed and map index prepared once for all global matching calls
+    std::unique_ptr<MatchingEngine> globEngine;
+    Matching::Settings matchingSettings(settings);
+    // map files read as separate shards instead of the merged map
+    if(!map.getShards().empty()){
+        globEngine.reset(new MatchingEngine(matchingSettings, map.getShards()));
+    }
+    else{
+        globEngine.reset(new MatchingEngine(matchingSettings, mapObjInstances, &map.getIndex()));
+    }
+    // previous frame is added as the only shard, without an index, for every incremental matching call
+    MatchingEngine incrEngine(matchingSettings, std::vector<vectorObjInstance>{});
 
 	vectorObjInstance prevObjInstances;
 	Vector7d prevPose;
@@ -187,10 +201,18 @@ void PlaneSlam::run(){
 	
     // variables used for accumulation
 //    vector<ObjInstance> accObjInstances;
-    Map accMap;
+    Map accMap(Map::readMergeParams(settings));
     Vector7d accStartFramePose;
+    int accStartFrameIdx = -1;
     int accFrames = 50;
     
+    // state of global localization carried between consecutive calls
+    Matching::TemporalState globTemporalState;
+    bool temporalSeeding = (int)settings["matching"]["temporalSeeding"];
+    // start of the accumulation localized by the previous call and the last frame without odometry
+    int globTemporalAccStartIdx = -1;
+    int voLostFrameIdx = -1;
+    
     int processNewFrameSkip = 1;
     
     
@@ -222,6 +244,10 @@ void PlaneSlam::run(){
 	while((curFrameIdx = fileGrabber.getFrame(rgb, depth, objInstances, accelData, pose, voPose, voCorr, accMap)) >= 0) {
         cout << "curFrameIdx = " << curFrameIdx << endl;
         
+        if(!voCorr){
+            voLostFrameIdx = curFrameIdx;
+        }
+        
         int64_t timestamp = (int64_t) curFrameIdx * 1e6 / frameRate;
         cout << "timestamp = " << timestamp << endl;
         
@@ -456,8 +482,9 @@ void PlaneSlam::run(){
                     if (((curFrameIdx - framesSkipped)/processNewFrameSkip) % accFrames == 0) {
                         cout << endl << "starting new accumulation" << endl << endl;
                 
-                        accMap = Map();
+                        accMap = Map(Map::readMergeParams(settings));
                         accStartFramePose = voPose;
+                        accStartFrameIdx = curFrameIdx;
 //                        accStartFramePose = pose;
                     }
                     
@@ -565,9 +592,19 @@ void PlaneSlam::run(){
                 accObjInstances.push_back(curObj);
             }
     
+            // previous fix is useful only if odometry connects it with the current accumulation,
+            // so it is dropped if any frame since the previous accumulation lacked odometry
+            if(voLostFrameIdx > globTemporalAccStartIdx){
+                globTemporalState.reset();
+            }
+    
             evaluateMatching(settings,
                              accObjInstances,
-                             mapObjInstances,
+                             globEngine.get(),
+                             nullptr,
+                             temporalSeeding ? &globTemporalState : nullptr,
+                             // objects of the accumulated map are expressed in its first frame
+                             accStartFramePose,
                              inputResGlobFile,
                              outputResGlobFile,
                              pose,
@@ -583,6 +620,7 @@ void PlaneSlam::run(){
                              curViewer,
                              curViewPort1,
                              curViewPort2);
+            globTemporalAccStartIdx = accStartFrameIdx;
             
             visRecCodes.push_back(curRecCode);
             visGtPoses.push_back(pose);
@@ -653,7 +691,10 @@ void PlaneSlam::run(){
     
             evaluateMatching(settings,
                              curObjInstances,
-                             prevObjInstances,
+                             &incrEngine,
+                             &prevObjInstances,
+                             nullptr,
+                             voPose,
                              inputResIncrFile,
                              outputResIncrFile,
                              gtTransSE3Quat.toVector(),
@@ -906,6 +947,8 @@ void PlaneSlam::run(){
         cout << "end frame" << endl;
 	}
 
+    globEngine->getStats().print();
+    
 	cout << "corrCnt = " << corrCnt << endl;
 	cout << "incorrCnt = " << incorrCnt << endl;
 	cout << "unkCnt = " << unkCnt << endl;
@@ -1105,7 +1148,10 @@ void PlaneSlam::run(){
 
 void PlaneSlam::evaluateMatching(const cv::FileStorage &fs,
                                  const vectorObjInstance &objInstances1,
-                                 const vectorObjInstance &objInstances2,
+                                 MatchingEngine *engine,
+                                 const vectorObjInstance *oneShotShard,
+                                 Matching::TemporalState *temporalState,
+                                 const Vector7d &odomPose,
                                  std::ifstream &inputResFile,
                                  std::ofstream &outputResFile,
                                  const Vector7d &gtTransform,
@@ -1166,17 +1212,31 @@ void PlaneSlam::evaluateMatching(const cv::FileStorage &fs,
         cout << "results read" << endl;
     }
     else {
-        matchType = Matching::matchFrameToMap(settings,
-                                              objInstances1,
-                                              objInstances2,
-                                              planesTrans,
-                                              planesTransScores,
-                                              planesTransFits,
-                                              planesTransDistinct,
-                                              transforms,
-                                              viewer,
-                                              viewPort1,
-                                              viewPort2);
+        Matching::MatchOptions options;
+        if(temporalState){
+            options.temporalState = temporalState;
+            options.odomPose = odomPose;
+        }
+        // matched once, so it is not worth building an index
+        int oneShotShardIdx = -1;
+        if(oneShotShard){
+            oneShotShardIdx = engine->addShard(*oneShotShard, nullptr, false);
+        }
+        Matching::MatchResult result;
+        matchType = engine->match(objInstances1,
+                                  options,
+                                  result,
+                                  viewer,
+                                  viewPort1,
+                                  viewPort2);
+        if(oneShotShard){
+            engine->removeShard(oneShotShardIdx);
+        }
+        planesTrans = result.bestTrans;
+        planesTransScores = result.bestTransProbs;
+        planesTransFits = result.bestTransFits;
+        planesTransDistinct = result.bestTransDistinct;
+        transforms = result.transforms;
     }
     
     g2o::SE3Quat gtTransformSE3Quat(gtTransform);
@@ -0,0 +1,102 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <cmath>
+#include <algorithm>
+
+#include "ProbDist.hpp"
+
+using namespace std;
+
+// 21 bits for every coordinate of a cell
+static int64_t cellKey(int64_t x, int64_t y, int64_t z){
+    static constexpr int64_t mask = (int64_t(1) << 21) - 1;
+    return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
+}
+
+ProbDist::ProbDist(const Eigen::Matrix<double, 6, 6> &infMat,
+                   double maxExp)
+    : infMat(infMat)
+{
+    // d^T * infMat * d >= minEig * ||d||^2
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 6, 6>> evd(infMat);
+    double minEig = evd.eigenvalues()(0);
+    cutoffRad = sqrt(maxExp / max(minEig, 1e-9));
+}
+
+void ProbDist::addKernel(const Vector7d &kPt, double weight) {
+    Kernel kernel;
+    kernel.kPtSE3Quat = g2o::SE3Quat(kPt);
+    kernel.t = kernel.kPtSE3Quat.translation();
+    kernel.q = kernel.kPtSE3Quat.rotation();
+    kernel.weight = weight;
+    
+    cells[compCellKey(kernel.t)].push_back(kernels.size());
+    kernels.push_back(kernel);
+}
+
+double ProbDist::eval(const Vector7d &pt) const {
+    // inverse of the point computed once for all kernels
+    g2o::SE3Quat ptSE3QuatInv = g2o::SE3Quat(pt).inverse();
+    Eigen::Vector3d t = pt.head<3>();
+    Eigen::Quaterniond q(pt(6), pt(3), pt(4), pt(5));
+    q.normalize();
+    
+    double cutoffRadSq = cutoffRad * cutoffRad;
+    int64_t cx = (int64_t)floor(t(0) / cutoffRad);
+    int64_t cy = (int64_t)floor(t(1) / cutoffRad);
+    int64_t cz = (int64_t)floor(t(2) / cutoffRad);
+    
+    double res = 0.0;
+    for(int64_t x = cx - 1; x <= cx + 1; ++x) {
+        for (int64_t y = cy - 1; y <= cy + 1; ++y) {
+            for (int64_t z = cz - 1; z <= cz + 1; ++z) {
+                auto it = cells.find(cellKey(x, y, z));
+                if(it == cells.end()){
+                    continue;
+                }
+                for(int k : it->second){
+                    const Kernel &kernel = kernels[k];
+                    double tDistSq = (kernel.t - t).squaredNorm();
+                    if(tDistSq > cutoffRadSq){
+                        continue;
+                    }
+                    double ang = 2.0 * acos(min(fabs(q.dot(kernel.q)), 1.0));
+                    if(tDistSq + ang * ang > cutoffRadSq){
+                        continue;
+                    }
+                    
+                    Vector6d diff = (ptSE3QuatInv * kernel.kPtSE3Quat).log();
+                    res += kernel.weight * exp(-diff.transpose() * infMat * diff);
+                }
+            }
+        }
+    }
+    return res;
+}
+
+int64_t ProbDist::compCellKey(const Eigen::Vector3d &t) const {
+    return cellKey((int64_t)floor(t(0) / cutoffRad),
+                     (int64_t)floor(t(1) / cutoffRad),
+                     (int64_t)floor(t(2) / cutoffRad));
+}
@@ -0,0 +1,191 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <algorithm>
+#include <exception>
+
+#include "ThreadPool.hpp"
+
+using namespace std;
+
+// index of the queue owned by the current thread, -1 for threads outside of any pool
+static thread_local const ThreadPool *curPool = nullptr;
+static thread_local int curQueueIdx = -1;
+
+ThreadPool::ThreadPool(int numThreads)
+    : numQueued(0),
+      nextQueue(0),
+      stop(false)
+{
+    if(numThreads <= 0){
+        numThreads = max(1u, thread::hardware_concurrency());
+    }
+    // last queue is used by threads that are not workers of this pool
+    for(int q = 0; q < numThreads; ++q){
+        queues.emplace_back(new WorkerQueue());
+    }
+    for(int w = 0; w < numThreads - 1; ++w){
+        workers.emplace_back(&ThreadPool::workerLoop, this, w);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        unique_lock<mutex> lock(wakeMutex);
+        stop = true;
+    }
+    wakeCv.notify_all();
+    for(thread &worker : workers){
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(int numItems,
+                             int chunkSize,
+                             const std::function<void(int, int, int)> &func)
+{
+    if(numItems <= 0){
+        return;
+    }
+    chunkSize = max(chunkSize, 1);
+    int nChunks = numChunks(numItems, chunkSize);
+
+    // nothing to share - run in the calling thread
+    if(workers.empty() || nChunks == 1){
+        for(int c = 0; c < nChunks; ++c){
+            func(c, c * chunkSize, min((c + 1) * chunkSize, numItems));
+        }
+        return;
+    }
+
+    struct State {
+        atomic<int> remaining;
+        mutex doneMutex;
+        condition_variable doneCv;
+        exception_ptr exc;
+    };
+    // shared_ptr, because the last task can still hold the state after it is signaled
+    shared_ptr<State> state = make_shared<State>();
+    state->remaining = nChunks;
+
+    int ownQueueIdx = (curPool == this) ? curQueueIdx : (int)queues.size() - 1;
+    for(int c = 0; c < nChunks; ++c){
+        int beg = c * chunkSize;
+        int end = min((c + 1) * chunkSize, numItems);
+        // spread chunks over the workers, stealing balances the rest
+        int queueIdx = (nextQueue++) % queues.size();
+        push(queueIdx, [state, &func, c, beg, end](){
+            try {
+                func(c, beg, end);
+            }
+            catch(...) {
+                unique_lock<mutex> lock(state->doneMutex);
+                if(!state->exc){
+                    state->exc = current_exception();
+                }
+            }
+            if(--state->remaining == 0){
+                unique_lock<mutex> lock(state->doneMutex);
+                state->doneCv.notify_all();
+            }
+        });
+    }
+
+    // help until there is nothing left to take, then wait for chunks run by the others
+    while(state->remaining > 0){
+        if(!tryRunOne(ownQueueIdx)){
+            unique_lock<mutex> lock(state->doneMutex);
+            state->doneCv.wait(lock, [&state](){ return state->remaining == 0; });
+        }
+    }
+
+    if(state->exc){
+        rethrow_exception(state->exc);
+    }
+}
+
+int ThreadPool::numChunks(int numItems, int chunkSize) {
+    chunkSize = max(chunkSize, 1);
+    return (numItems + chunkSize - 1) / chunkSize;
+}
+
+int ThreadPool::chooseChunkSize(int numItems, int chunksPerThread) const {
+    int chunks = max(getNumThreads() * chunksPerThread, 1);
+    return max((numItems + chunks - 1) / chunks, 1);
+}
+
+void ThreadPool::push(int queueIdx, std::function<void()> &&task) {
+    {
+        unique_lock<mutex> lock(queues[queueIdx]->mutex);
+        queues[queueIdx]->tasks.push_back(move(task));
+    }
+    {
+        unique_lock<mutex> lock(wakeMutex);
+        ++numQueued;
+    }
+    wakeCv.notify_one();
+}
+
+bool ThreadPool::tryRunOne(int ownQueueIdx) {
+    function<void()> task;
+    // newest task from the own queue first, it is the most likely to have its data in cache
+    {
+        WorkerQueue &own = *queues[ownQueueIdx];
+        unique_lock<mutex> lock(own.mutex);
+        if(!own.tasks.empty()){
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+    // steal the oldest task from the others
+    for(int q = 1; q < queues.size() && !task; ++q){
+        WorkerQueue &other = *queues[(ownQueueIdx + q) % queues.size()];
+        unique_lock<mutex> lock(other.mutex);
+        if(!other.tasks.empty()){
+            task = move(other.tasks.front());
+            other.tasks.pop_front();
+        }
+    }
+    if(!task){
+        return false;
+    }
+    --numQueued;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(int queueIdx) {
+    curPool = this;
+    curQueueIdx = queueIdx;
+
+    while(true){
+        if(tryRunOne(queueIdx)){
+            continue;
+        }
+        unique_lock<mutex> lock(wakeMutex);
+        wakeCv.wait(lock, [this](){ return stop || numQueued > 0; });
+        if(stop && numQueued == 0){
+            break;
+        }
+    }
+}
@@ -0,0 +1,127 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <cmath>
+#include <algorithm>
+
+#include "VoteAccum.hpp"
+#include "Misc.hpp"
+
+using namespace std;
+
+// 10 bits for every coordinate of a cell
+static int64_t cellKey(const int64_t coords[6]){
+    static constexpr int64_t mask = (int64_t(1) << 10) - 1;
+    int64_t key = 0;
+    for(int i = 0; i < 6; ++i){
+        key = (key << 10) | (coords[i] & mask);
+    }
+    return key;
+}
+
+VoteAccum::VoteAccum(double transCellSize,
+                     double rotCellSize)
+    : transCellSize(transCellSize),
+      rotCellSize(rotCellSize)
+{}
+
+void VoteAccum::addVote(const Vector7d &pose, double weight, int id) {
+    int64_t coords[6];
+    compCellCoords(pose, coords);
+    
+    Cell &cell = cells[cellKey(coords)];
+    cell.weight += weight;
+    if(cell.bestId < 0 || weight > cell.bestWeight){
+        cell.bestWeight = weight;
+        cell.bestId = id;
+    }
+}
+
+double VoteAccum::eval(const Vector7d &pose) const {
+    int64_t coords[6];
+    compCellCoords(pose, coords);
+    
+    auto it = cells.find(cellKey(coords));
+    if(it == cells.end()){
+        return 0.0;
+    }
+    return it->second.weight;
+}
+
+std::vector<std::pair<double, int>> VoteAccum::getPeaks(int numPeaks, bool refine) const {
+    vector<pair<double, int64_t>> cellVals;
+    for(const pair<const int64_t, Cell> &cell : cells){
+        cellVals.emplace_back(cell.second.weight, cell.first);
+    }
+    // linear selection, the rest of the cells is not sorted
+    if(numPeaks < cellVals.size()){
+        nth_element(cellVals.begin(), cellVals.begin() + numPeaks, cellVals.end(),
+                    [](const pair<double, int64_t> &lhs, const pair<double, int64_t> &rhs){
+                        return lhs.first > rhs.first;
+                    });
+        cellVals.resize(numPeaks);
+    }
+    
+    vector<pair<double, int>> peaks;
+    for(const pair<double, int64_t> &cellVal : cellVals){
+        double val = cellVal.first;
+        if(refine){
+            int64_t key = cellVal.second;
+            int64_t coords[6];
+            for(int i = 5; i >= 0; --i){
+                // sign extension of 10 bit coordinates
+                coords[i] = ((key & ((int64_t(1) << 10) - 1)) ^ 512) - 512;
+                key >>= 10;
+            }
+            
+            val = 0.0;
+            for(int n = 0; n < 729; ++n){
+                int64_t nhCoords[6];
+                int rem = n;
+                for(int i = 0; i < 6; ++i){
+                    nhCoords[i] = coords[i] + rem % 3 - 1;
+                    rem /= 3;
+                }
+                auto it = cells.find(cellKey(nhCoords));
+                if(it != cells.end()){
+                    val += it->second.weight;
+                }
+            }
+        }
+        peaks.emplace_back(val, cells.at(cellVal.second).bestId);
+    }
+    sort(peaks.begin(), peaks.end(),
+         [](const pair<double, int> &lhs, const pair<double, int> &rhs){
+             return lhs.first > rhs.first;
+         });
+    return peaks;
+}
+
+void VoteAccum::compCellCoords(const Vector7d &pose, int64_t coords[6]) const {
+    Eigen::Quaterniond q(pose(6), pose(3), pose(4), pose(5));
+    Eigen::Vector3d rotLog = Misc::logMap(q);
+    for(int i = 0; i < 3; ++i){
+        coords[i] = (int64_t)floor(pose(i) / transCellSize);
+        coords[3 + i] = (int64_t)floor(rotLog(i) / rotCellSize);
+    }
+}
@@ -0,0 +1,146 @@
+/*
+    Copyright (c) 2017 Mobile Robots Laboratory at Poznan University of Technology:
+    -Jan Wietrzykowski name.surname [at] put.poznan.pl
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "ZBuffer.hpp"
+
+using namespace std;
+
+ZBuffer::ZBuffer()
+    : rows(0),
+      cols(0),
+      fx(1.0),
+      fy(1.0),
+      cx(0.0),
+      cy(0.0)
+{}
+
+void ZBuffer::reset(int irows, int icols, const cv::Mat &cameraMatrix) {
+    rows = irows;
+    cols = icols;
+    fx = cameraMatrix.at<float>(0, 0);
+    fy = cameraMatrix.at<float>(1, 1);
+    cx = cameraMatrix.at<float>(0, 2);
+    cy = cameraMatrix.at<float>(1, 2);
+    
+    // keeps capacity from the previous frames
+    depth.assign(rows * cols, numeric_limits<float>::infinity());
+    spans.clear();
+    objs.clear();
+}
+
+void ZBuffer::addObj(int id,
+                     const std::vector<vectorVector2d> &polys,
+                     const Eigen::Vector4d &planeEq)
+{
+    static constexpr double eps = 1e-6;
+    
+    // plane through camera center
+    if(abs(planeEq(3)) < eps){
+        return;
+    }
+    // point on the ray through (u, v) is s * [(u - cx)/fx, (v - cy)/fy, 1], and depth equals s
+    ObjPlane objPlane;
+    objPlane.id = id;
+    objPlane.a = -planeEq(0) / (fx * planeEq(3));
+    objPlane.b = -planeEq(1) / (fy * planeEq(3));
+    objPlane.c = -(planeEq(2) - planeEq(0) * cx / fx - planeEq(1) * cy / fy) / planeEq(3);
+    int objIdx = objs.size();
+    objs.push_back(objPlane);
+    
+    double minY = numeric_limits<double>::max();
+    double maxY = -numeric_limits<double>::max();
+    for(const vectorVector2d &poly : polys){
+        for(const Eigen::Vector2d &pt : poly){
+            minY = min(minY, pt(1));
+            maxY = max(maxY, pt(1));
+        }
+    }
+    int begRow = max((int)ceil(minY), 0);
+    int endRow = min((int)floor(maxY), rows - 1);
+    
+    for(int r = begRow; r <= endRow; ++r){
+        // even-odd rule over all polygons of the object
+        crossings.clear();
+        for(const vectorVector2d &poly : polys){
+            for(int i = 0; i < poly.size(); ++i){
+                const Eigen::Vector2d &cur = poly[i];
+                const Eigen::Vector2d &next = poly[(i + 1) % poly.size()];
+                if((cur(1) > r) != (next(1) > r)){
+                    double t = (r - cur(1)) / (next(1) - cur(1));
+                    crossings.push_back(cur(0) + t * (next(0) - cur(0)));
+                }
+            }
+        }
+        sort(crossings.begin(), crossings.end());
+        
+        for(int cr = 0; cr + 1 < crossings.size(); cr += 2){
+            // pixel centers in [crossings[cr], crossings[cr + 1])
+            Span span;
+            span.row = r;
+            span.beg = max((int)ceil(crossings[cr]), 0);
+            span.end = min((int)ceil(crossings[cr + 1]), cols);
+            span.obj = objIdx;
+            if(span.beg >= span.end){
+                continue;
+            }
+            
+            float *depthRow = &depth[r * cols];
+            double invDepth = objPlane.a * span.beg + objPlane.b * r + objPlane.c;
+            for(int c = span.beg; c < span.end; ++c, invDepth += objPlane.a){
+                if(invDepth > 0.0){
+                    depthRow[c] = min(depthRow[c], (float)(1.0 / invDepth));
+                }
+            }
+            spans.push_back(span);
+        }
+    }
+}
+
+void ZBuffer::countVisible(double depthTol,
+                           double maxDepth,
+                           std::map<int, int> &idToCnt) const
+{
+    vector<int> objCnt(objs.size(), 0);
+    for(const Span &span : spans){
+        const ObjPlane &objPlane = objs[span.obj];
+        const float *depthRow = &depth[span.row * cols];
+        double invDepth = objPlane.a * span.beg + objPlane.b * span.row + objPlane.c;
+        int cnt = 0;
+        for(int c = span.beg; c < span.end; ++c, invDepth += objPlane.a){
+            if(invDepth > 0.0){
+                float d = 1.0 / invDepth;
+                if(d - depthRow[c] < depthTol && d < maxDepth){
+                    ++cnt;
+                }
+            }
+        }
+        objCnt[span.obj] += cnt;
+    }
+    for(int o = 0; o < objs.size(); ++o){
+        idToCnt[objs[o].id] += objCnt[o];
+    }
+}
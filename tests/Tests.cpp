@@ -3,22 +3,34 @@
 //
 
 #define CATCH_CONFIG_MAIN
+// the alternative signal stack of catch does not compile with newer glibc
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 #include "catch.hpp"
 
 #include <vector>
+#include <map>
+#include <algorithm>
 
 #include <Eigen/Eigen>
 
 #include "Matching.hpp"
+#include "ConcaveHull.hpp"
 #include "Misc.hpp"
+#include "ProbDist.hpp"
+#include "PlaneSeg.hpp"
+#include "MapIndex.hpp"
+#include "ObjGrid.hpp"
+#include "ZBuffer.hpp"
+#include "VoteAccum.hpp"
+#include "ThreadPool.hpp"
 
 using namespace std;
 
-void transformObjs(const std::vector<Eigen::Vector3d> &points,
-                   const std::vector<Eigen::Vector4d> &planes,
+void transformObjs(const vectorVector3d &points,
+                   const vectorVector4d &planes,
                    const std::vector<Vector6d> &lines,
-                   std::vector<Eigen::Vector3d> &retPoints,
-                   std::vector<Eigen::Vector4d> &retPlanes,
+                   vectorVector3d &retPoints,
+                   vectorVector4d &retPlanes,
                    std::vector<Vector6d> &retLines,
                    Eigen::Matrix3d rotMat,
                    Eigen::Vector3d trans,
@@ -56,13 +68,13 @@ void transformObjs(const std::vector<Eigen::Vector3d> &points,
 }
 
 
-void testFullConstr(const std::vector<Eigen::Vector3d> &points,
-                    const std::vector<Eigen::Vector3d> &virtPoints,
-                    const std::vector<Eigen::Vector3d> &dirs,
+void testFullConstr(const vectorVector3d &points,
+                    const vectorVector3d &virtPoints,
+                    const vectorVector3d &dirs,
                     const std::vector<double> &dists,
-                    const std::vector<Eigen::Vector3d> &distDirs,
-                    const std::vector<Eigen::Vector3d> &distPts,
-                    const std::vector<Eigen::Vector3d> &distPtsDirs,
+                    const vectorVector3d &distDirs,
+                    const vectorVector3d &distPts,
+                    const vectorVector3d &distPtsDirs,
                     bool &fullConstrRot,
                     bool &fullConstrTrans)
 {
@@ -150,8 +162,8 @@ void testFullConstr(const std::vector<Eigen::Vector3d> &points,
 
 }
 
-Vector7d testTransform(const std::vector<Eigen::Vector3d> &points,
-                       const std::vector<Eigen::Vector4d> &planes,
+Vector7d testTransform(const vectorVector3d &points,
+                       const vectorVector4d &planes,
                        const std::vector<Vector6d> &lines,
                        Vector7d transform,
                        double sinValsThresh)
@@ -175,13 +187,13 @@ Vector7d testTransform(const std::vector<Eigen::Vector3d> &points,
     Eigen::Vector4d rot = transform.tail<4>();
     Eigen::Matrix3d rotMat = Eigen::Quaterniond(rot[3], rot[0], rot[1], rot[2]).toRotationMatrix();
 
-    std::vector<Eigen::Vector3d> retPoints;
-    std::vector<Eigen::Vector3d> retVirtPoints;
-    std::vector<Eigen::Vector3d> retDirs;
+    vectorVector3d retPoints;
+    vectorVector3d retVirtPoints;
+    vectorVector3d retDirs;
     std::vector<double> retDists;
-    std::vector<Eigen::Vector3d> retDistDirs;
-    std::vector<Eigen::Vector3d> retDistPts;
-    std::vector<Eigen::Vector3d> retDistPtsDirs;
+    vectorVector3d retDistDirs;
+    vectorVector3d retDistPts;
+    vectorVector3d retDistPtsDirs;
     Matching::convertToPointsDirsDists(points,
                                        planes,
                                        lines,
@@ -206,8 +218,8 @@ Vector7d testTransform(const std::vector<Eigen::Vector3d> &points,
                    fullConstrTrans);
 
 
-    vector<Eigen::Vector3d> transPoints;
-    vector<Eigen::Vector4d> transPlanes;
+    vectorVector3d transPoints;
+    vectorVector4d transPlanes;
     vector<Vector6d> transLines;
     transformObjs(points,
                   planes,
@@ -220,13 +232,13 @@ Vector7d testTransform(const std::vector<Eigen::Vector3d> &points,
                   0.01,
                   0.01);
 
-    std::vector<Eigen::Vector3d> retTransPoints;
-    std::vector<Eigen::Vector3d> retTransVirtPoints;
-    std::vector<Eigen::Vector3d> retTransDirs;
+    vectorVector3d retTransPoints;
+    vectorVector3d retTransVirtPoints;
+    vectorVector3d retTransDirs;
     std::vector<double> retTransDists;
-    std::vector<Eigen::Vector3d> retTransDistDirs;
-    std::vector<Eigen::Vector3d> retTransDistPts;
-    std::vector<Eigen::Vector3d> retTransDistPtsDirs;
+    vectorVector3d retTransDistDirs;
+    vectorVector3d retTransDistPts;
+    vectorVector3d retTransDistPtsDirs;
     Matching::convertToPointsDirsDists(transPoints,
                        transPlanes,
                        transLines,
@@ -328,9 +340,9 @@ TEST_CASE("best transformations are correct", "[transformations]"){
 
     cout << "Starting test" << endl;
     //[x, y, z]
-    vector<Eigen::Vector3d> points;
+    vectorVector3d points;
     //[nx, ny, nz, -d]
-    vector<Eigen::Vector4d> planes;
+    vectorVector4d planes;
     //[px, py, pz, nx, ny, nz]
     vector<Vector6d> lines;
 
@@ -387,14 +399,14 @@ TEST_CASE("best transformations are correct", "[transformations]"){
             std::default_random_engine gen;
             std::uniform_int_distribution<int> distrPts(0, numPts - 1);
 
-            vector<Eigen::Vector3d> curPts;
+            vectorVector3d curPts;
             for(int p = 0; p < cpts; ++p){
                 int idx = distrPts(gen);
                 curPts.push_back(points[idx]);
             }
 
             testTransform(curPts,
-                          vector<Eigen::Vector4d>(),
+                          vectorVector4d(),
                           vector<Vector6d>(),
                           transform,
                           sinValsThresh);
@@ -405,13 +417,13 @@ TEST_CASE("best transformations are correct", "[transformations]"){
             std::default_random_engine gen;
             std::uniform_int_distribution<int> distrPls(0, numPls - 1);
 
-            vector<Eigen::Vector4d> curPls;
+            vectorVector4d curPls;
             for(int pl = 0; pl < cpls; ++pl){
                 int idx = distrPls(gen);
                 curPls.push_back(planes[idx]);
             }
 
-            testTransform(vector<Eigen::Vector3d>(),
+            testTransform(vectorVector3d(),
                           curPls,
                           vector<Vector6d>(),
                           transform,
@@ -430,8 +442,8 @@ TEST_CASE("best transformations are correct", "[transformations]"){
                 curLines.push_back(lines[idx]);
             }
 
-            testTransform(vector<Eigen::Vector3d>(),
-                          vector<Eigen::Vector4d>(),
+            testTransform(vectorVector3d(),
+                          vectorVector4d(),
                           curLines,
                           transform,
                           sinValsThresh);
@@ -444,7 +456,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
 
                 std::uniform_int_distribution<int> distrPts(0, numPts - 1);
 
-                vector<Eigen::Vector3d> curPts;
+                vectorVector3d curPts;
                 for (int p = 0; p < cpts; ++p) {
                     int idx = distrPts(gen);
                     curPts.push_back(points[idx]);
@@ -453,7 +465,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
 
                 std::uniform_int_distribution<int> distrPls(0, numPls - 1);
 
-                vector<Eigen::Vector4d> curPls;
+                vectorVector4d curPls;
                 for (int pl = 0; pl < cpls; ++pl) {
                     int idx = distrPls(gen);
                     curPls.push_back(planes[idx]);
@@ -473,7 +485,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
                 std::default_random_engine gen;
                 std::uniform_int_distribution<int> distrPts(0, numPts - 1);
 
-                vector<Eigen::Vector3d> curPts;
+                vectorVector3d curPts;
                 for (int p = 0; p < cpts; ++p) {
                     int idx = distrPts(gen);
                     curPts.push_back(points[idx]);
@@ -488,7 +500,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
                 }
 
                 testTransform(curPts,
-                              vector<Eigen::Vector4d>(),
+                              vectorVector4d(),
                               curLines,
                               transform,
                               sinValsThresh);
@@ -501,7 +513,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
                 std::default_random_engine gen;
                 std::uniform_int_distribution<int> distrPls(0, numPls - 1);
 
-                vector<Eigen::Vector4d> curPls;
+                vectorVector4d curPls;
                 for (int pl = 0; pl < cpls; ++pl) {
                     int idx = distrPls(gen);
                     curPls.push_back(planes[idx]);
@@ -515,7 +527,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
                     curLines.push_back(lines[idx]);
                 }
 
-                testTransform(vector<Eigen::Vector3d>(),
+                testTransform(vectorVector3d(),
                               curPls,
                               curLines,
                               transform,
@@ -531,7 +543,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
 
                     std::uniform_int_distribution<int> distrPts(0, numPts - 1);
 
-                    vector<Eigen::Vector3d> curPts;
+                    vectorVector3d curPts;
                     for (int p = 0; p < cpts; ++p) {
                         int idx = distrPts(gen);
                         curPts.push_back(points[idx]);
@@ -540,7 +552,7 @@ TEST_CASE("best transformations are correct", "[transformations]"){
 
                     std::uniform_int_distribution<int> distrPls(0, numPls - 1);
 
-                    vector<Eigen::Vector4d> curPls;
+                    vectorVector4d curPls;
                     for (int pl = 0; pl < cpls; ++pl) {
                         int idx = distrPls(gen);
                         curPls.push_back(planes[idx]);
@@ -564,3 +576,612 @@ TEST_CASE("best transformations are correct", "[transformations]"){
         }
     }
 }
+
+ConcaveHull makeHull(const std::vector<vectorVector2d> &polys2d)
+{
+    // plane z = 0
+    Eigen::Vector3d plNormal(0.0, 0.0, 1.0);
+    Eigen::Vector3d origin(0.0, 0.0, 0.0);
+    Eigen::Vector3d xAxis(1.0, 0.0, 0.0);
+    Eigen::Vector3d yAxis(0.0, 1.0, 0.0);
+
+    vector<ConcaveHull::Polygon_2> polygons;
+    vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> polygons3d;
+    for(const vectorVector2d &poly2d : polys2d){
+        ConcaveHull::Polygon_2 poly;
+        pcl::PointCloud<pcl::PointXYZRGB>::Ptr poly3d(new pcl::PointCloud<pcl::PointXYZRGB>());
+        for(const Eigen::Vector2d &pt : poly2d){
+            poly.push_back(ConcaveHull::Point_2(pt.x(), pt.y()));
+            pcl::PointXYZRGB pt3d;
+            pt3d.getVector3fMap() = (origin + pt.x() * xAxis + pt.y() * yAxis).cast<float>();
+            poly3d->push_back(pt3d);
+        }
+        polygons.push_back(poly);
+        polygons3d.push_back(poly3d);
+    }
+    return ConcaveHull(polygons, polygons3d, plNormal, 0.0, origin, xAxis, yAxis);
+}
+
+TEST_CASE("inexact intersection area matches exact one", "[hulls]"){
+    SECTION("concave polygons"){
+        ConcaveHull hullL = makeHull({{{0.0, 0.0}, {3.0, 0.0}, {3.0, 1.0}, {1.0, 1.0}, {1.0, 3.0}, {0.0, 3.0}}});
+        // clockwise
+        ConcaveHull hullSq = makeHull({{{0.5, 0.5}, {0.5, 2.5}, {2.5, 2.5}, {2.5, 0.5}}});
+
+        double exactArea = hullL.intersectArea(hullSq, ConcaveHull::IntersectMode::Exact);
+        double inexactArea = hullL.intersectArea(hullSq, ConcaveHull::IntersectMode::Inexact);
+        REQUIRE(exactArea == Approx(1.75).epsilon(1e-6));
+        REQUIRE(inexactArea == Approx(exactArea).epsilon(1e-6));
+    }
+
+    SECTION("random star-shaped polygons"){
+        std::default_random_engine gen;
+        std::uniform_real_distribution<double> distrR(0.5, 1.5);
+        std::uniform_real_distribution<double> distrAng(-M_PI, M_PI);
+
+        for(int t = 0; t < 20; ++t){
+            vector<vectorVector2d> polys1(1), polys2(1);
+            static constexpr int numPts = 16;
+            for(int p = 0; p < numPts; ++p){
+                double ang = 2 * M_PI * p / numPts;
+                polys1[0].emplace_back(distrR(gen) * cos(ang), distrR(gen) * sin(ang));
+                polys2[0].emplace_back(distrR(gen) * cos(ang), distrR(gen) * sin(ang));
+            }
+            ConcaveHull hull1 = makeHull(polys1);
+            ConcaveHull hull2 = makeHull(polys2);
+
+            // rotation around z keeps both polygons star-shaped with respect to the origin,
+            // so the intersection has no holes, which are not subtracted in the exact mode
+            double ang = distrAng(gen);
+            Vector7d transform;
+            transform << 0.0, 0.0, 0.0, 0.0, 0.0, sin(ang / 2), cos(ang / 2);
+            ConcaveHull hull2Trans = hull2.transform(transform);
+
+            double exactArea = hull1.intersectArea(hull2Trans, ConcaveHull::IntersectMode::Exact);
+            double inexactArea = hull1.intersectArea(hull2Trans, ConcaveHull::IntersectMode::Inexact);
+            // 3D polygons are stored in single precision
+            REQUIRE(inexactArea == Approx(exactArea).margin(1e-4));
+        }
+    }
+
+    SECTION("rasters"){
+        ConcaveHull::IntersectParams rasterParams(ConcaveHull::IntersectMode::Raster, 0.01);
+
+        ConcaveHull hullL = makeHull({{{0.0, 0.0}, {3.0, 0.0}, {3.0, 1.0}, {1.0, 1.0}, {1.0, 3.0}, {0.0, 3.0}}});
+        ConcaveHull hullSq = makeHull({{{0.5, 0.5}, {0.5, 2.5}, {2.5, 2.5}, {2.5, 0.5}}});
+
+        double exactArea = hullL.intersectArea(hullSq, ConcaveHull::IntersectMode::Exact);
+        double rasterArea = hullL.intersectArea(hullSq, rasterParams);
+        // error bounded by cells along the boundary
+        REQUIRE(rasterArea == Approx(exactArea).margin(0.05));
+
+        double ang = M_PI / 6;
+        Vector7d transform;
+        transform << 0.2, -0.1, 0.0, 0.0, 0.0, sin(ang / 2), cos(ang / 2);
+        exactArea = hullL.intersectArea(hullSq.transform(transform), ConcaveHull::IntersectMode::Exact);
+        rasterArea = hullL.intersectArea(hullSq, transform, rasterParams);
+        REQUIRE(rasterArea == Approx(exactArea).margin(0.05));
+
+        // the inexact mode intersects the other hull in place, without transforming it
+        double inexactArea = hullL.intersectArea(hullSq, transform, ConcaveHull::IntersectMode::Inexact);
+        REQUIRE(inexactArea == Approx(exactArea).margin(1e-4));
+    }
+}
+
+TEST_CASE("histogram distance matrix matches pairwise distances", "[appearance]"){
+    std::default_random_engine gen;
+    std::uniform_real_distribution<float> distr(0.0, 1.0);
+
+    // more rows than a single block
+    ObjInstance::HistMatrix hists1(5, ObjInstance::histBins);
+    ObjInstance::HistMatrix hists2(70, ObjInstance::histBins);
+    for(int r = 0; r < hists1.rows(); ++r){
+        for(int b = 0; b < ObjInstance::histBins; ++b){
+            hists1(r, b) = distr(gen);
+        }
+    }
+    for(int r = 0; r < hists2.rows(); ++r){
+        for(int b = 0; b < ObjInstance::histBins; ++b){
+            hists2(r, b) = distr(gen);
+        }
+    }
+
+    Eigen::MatrixXf dists;
+    ObjInstance::compHistDistMatrix(hists1, hists2, dists);
+    REQUIRE(dists.rows() == hists1.rows());
+    REQUIRE(dists.cols() == hists2.rows());
+    for(int r1 = 0; r1 < hists1.rows(); ++r1){
+        for(int r2 = 0; r2 < hists2.rows(); ++r2){
+            cv::Mat hist1(ObjInstance::histBins, 1, CV_32FC1);
+            cv::Mat hist2(ObjInstance::histBins, 1, CV_32FC1);
+            for(int b = 0; b < ObjInstance::histBins; ++b){
+                hist1.at<float>(b) = hists1(r1, b);
+                hist2.at<float>(b) = hists2(r2, b);
+            }
+            REQUIRE(dists(r1, r2) == Approx(ObjInstance::compHistDist(hist1, hist2)).epsilon(1e-5));
+        }
+    }
+}
+
+TEST_CASE("kernel density matches sum over all kernels", "[aggregation]"){
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> distrT(-1.0, 1.0);
+    std::normal_distribution<double> distrQ(0.0, 1.0);
+    std::uniform_real_distribution<double> distrW(0.1, 1.0);
+    
+    auto randPose = [&](double tRange){
+        Eigen::Vector4d q(distrQ(gen), distrQ(gen), distrQ(gen), distrQ(gen));
+        q.normalize();
+        Vector7d pose;
+        pose << tRange * distrT(gen), tRange * distrT(gen), tRange * distrT(gen),
+                q(0), q(1), q(2), q(3);
+        return pose;
+    };
+    
+    Eigen::Matrix<double, 6, 6> infMat = Eigen::Matrix<double, 6, 6>::Identity();
+    infMat.block<3, 3>(0, 0) *= 1.0 / (0.1 * 0.1);
+    infMat.block<3, 3>(3, 3) *= 1.0 / (5.0 * M_PI / 180.0 * 5.0 * M_PI / 180.0);
+    
+    ProbDist dist(infMat);
+    vectorVector7d kPts;
+    vector<double> weights;
+    for(int k = 0; k < 500; ++k){
+        kPts.push_back(randPose(2.0));
+        weights.push_back(distrW(gen));
+        dist.addKernel(kPts.back(), weights.back());
+    }
+    
+    // points at the kernels and at random poses
+    vectorVector7d pts(kPts.begin(), kPts.begin() + 50);
+    for(int p = 0; p < 50; ++p){
+        pts.push_back(randPose(2.0));
+    }
+    for(const Vector7d &pt : pts){
+        g2o::SE3Quat ptSE3QuatInv = g2o::SE3Quat(pt).inverse();
+        double refVal = 0.0;
+        for(int k = 0; k < kPts.size(); ++k){
+            Vector6d diff = (ptSE3QuatInv * g2o::SE3Quat(kPts[k])).log();
+            refVal += weights[k] * exp(-diff.transpose() * infMat * diff);
+        }
+        // skipped kernels contribute less than exp(-maxExp) each
+        REQUIRE(dist.eval(pt) == Approx(refVal).margin(1e-6));
+    }
+}
+
+TEST_CASE("SPRT passes correct and rejects wrong hypotheses", "[verification]"){
+    // box-like scene, frame equal to the map
+    vectorVector4d planes;
+    planes.push_back(Eigen::Vector4d(1.0, 0.0, 0.0, -1.0));
+    planes.push_back(Eigen::Vector4d(-1.0, 0.0, 0.0, -2.0));
+    planes.push_back(Eigen::Vector4d(0.0, 1.0, 0.0, -1.5));
+    planes.push_back(Eigen::Vector4d(0.0, -1.0, 0.0, -1.0));
+    planes.push_back(Eigen::Vector4d(0.0, 0.0, 1.0, -3.0));
+    planes.push_back(Eigen::Vector4d(0.0, 0.0, -1.0, -0.5));
+    planes.push_back(Eigen::Vector4d(0.0, 0.6, 0.8, -2.5));
+    planes.push_back(Eigen::Vector4d(0.6, 0.0, 0.8, -2.0));
+    vector<int> frameOrder;
+    for(int p = 0; p < planes.size(); ++p){
+        frameOrder.push_back(p);
+    }
+
+    Matching::PotMatchSet curSet{Matching::PotMatch(0, Matching::LineIdxs(), 0, Matching::LineIdxs()),
+                                 Matching::PotMatch(2, Matching::LineIdxs(), 2, Matching::LineIdxs()),
+                                 Matching::PotMatch(4, Matching::LineIdxs(), 4, Matching::LineIdxs())};
+
+    Matching::SprtParams sprtParams;
+    sprtParams.enabled = true;
+
+    int decision = 0;
+    int numSamples = 0;
+    Vector7d identity;
+    identity << 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0;
+    REQUIRE(Matching::checkSprt(identity, curSet, planes, planes, frameOrder, sprtParams, decision, numSamples));
+    REQUIRE(decision == 1);
+    REQUIRE(numSamples <= planes.size() - curSet.size());
+
+    Vector7d wrong;
+    wrong << 0.7, -0.4, 1.1, 0.0, 0.0, 0.0, 1.0;
+    REQUIRE_FALSE(Matching::checkSprt(wrong, curSet, planes, planes, frameOrder, sprtParams, decision, numSamples));
+    REQUIRE(decision == -1);
+}
+
+ObjInstance makeRectObj(int id,
+                        const Eigen::Vector3d &corner,
+                        const Eigen::Vector3d &axis1,
+                        const Eigen::Vector3d &axis2)
+{
+    static constexpr int numSteps = 20;
+    
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr points(new pcl::PointCloud<pcl::PointXYZRGB>());
+    for(int s1 = 0; s1 <= numSteps; ++s1){
+        for(int s2 = 0; s2 <= numSteps; ++s2){
+            pcl::PointXYZRGB pt;
+            pt.getVector3fMap() = (corner + axis1 * ((double)s1 / numSteps) + axis2 * ((double)s2 / numSteps)).cast<float>();
+            pt.r = 200;
+            pt.g = 120;
+            pt.b = 60;
+            points->push_back(pt);
+        }
+    }
+    // normal of the object is oriented along axis1 x axis2
+    PlaneSeg seg;
+    seg.setSegNormal(axis1.cross(axis2).normalized());
+    vectorPlaneSeg svs;
+    svs.push_back(seg);
+    return ObjInstance(id, ObjInstance::ObjType::Plane, points, svs);
+}
+
+vectorObjInstance makeRoomObjs(int idBeg, const Eigen::Vector3d &shift)
+{
+    // no two planes are parallel
+    vectorObjInstance objs;
+    objs.push_back(makeRectObj(idBeg + 0, shift + Eigen::Vector3d(-2.0, -2.0, -1.0),
+                               Eigen::Vector3d(4.0, 0.0, 0.0), Eigen::Vector3d(0.0, 4.0, 0.0)));
+    objs.push_back(makeRectObj(idBeg + 1, shift + Eigen::Vector3d(2.0, -2.0, -1.0),
+                               Eigen::Vector3d(0.0, 4.0, 0.0), Eigen::Vector3d(0.0, 0.0, 3.0)));
+    objs.push_back(makeRectObj(idBeg + 2, shift + Eigen::Vector3d(-2.0, 2.0, -1.0),
+                               Eigen::Vector3d(0.0, 0.0, 3.0), Eigen::Vector3d(4.0, 0.0, 0.0)));
+    objs.push_back(makeRectObj(idBeg + 3, shift + Eigen::Vector3d(-2.0, -2.0, 1.0),
+                               Eigen::Vector3d(2.0, 0.0, 0.0), Eigen::Vector3d(0.0, 1.5, 1.5)));
+    objs.push_back(makeRectObj(idBeg + 4, shift + Eigen::Vector3d(0.0, -2.0, 0.0),
+                               Eigen::Vector3d(0.0, 2.0, 0.0), Eigen::Vector3d(1.5, 0.0, 1.5)));
+    return objs;
+}
+
+TEST_CASE("potential sets are the same as from checking all triplets", "[matching]"){
+    static constexpr double planeDistThresh = 5.0;
+    static constexpr double angThresh = 0.26;
+    
+    vectorObjInstance mapObjs = makeRoomObjs(0, Eigen::Vector3d::Zero());
+    // farther than planeDistThresh from the others
+    mapObjs.push_back(makeRectObj(mapObjs.size(), Eigen::Vector3d(10.0, 10.0, 10.0),
+                                  Eigen::Vector3d(1.0, 1.0, 0.0), Eigen::Vector3d(0.0, 1.0, 1.0)));
+    vectorObjInstance frameObjs = mapObjs;
+    
+    vector<Matching::PotMatch> potMatches;
+    for(int of = 0; of < frameObjs.size(); ++of){
+        for(int om = 0; om < mapObjs.size(); ++om){
+            potMatches.emplace_back(om, Matching::LineIdxs(), of, Matching::LineIdxs());
+        }
+    }
+    
+    vector<vector<double>> mapDists(mapObjs.size(), vector<double>(mapObjs.size(), 0.0));
+    vector<vector<double>> frameDists(frameObjs.size(), vector<double>(frameObjs.size(), 0.0));
+    for(int o1 = 0; o1 < mapObjs.size(); ++o1){
+        for(int o2 = 0; o2 < mapObjs.size(); ++o2){
+            mapDists[o1][o2] = mapObjs[o1].getHull().minDistance(mapObjs[o2].getHull());
+            frameDists[o1][o2] = frameObjs[o1].getHull().minDistance(frameObjs[o2].getHull());
+        }
+    }
+    
+    // every triplet checked as a whole
+    vector<vector<int>> refPotSets;
+    for(int i = 0; i < potMatches.size(); ++i){
+        for(int j = i + 1; j < potMatches.size(); ++j){
+            for(int k = j + 1; k < potMatches.size(); ++k){
+                vector<int> curIdxs{i, j, k};
+                bool valid = true;
+                for(int p1 = 0; p1 < curIdxs.size(); ++p1){
+                    for(int p2 = p1 + 1; p2 < curIdxs.size(); ++p2){
+                        const Matching::PotMatch &pm1 = potMatches[curIdxs[p1]];
+                        const Matching::PotMatch &pm2 = potMatches[curIdxs[p2]];
+                        if(mapDists[pm1.plane1][pm2.plane1] > planeDistThresh ||
+                           frameDists[pm1.plane2][pm2.plane2] > planeDistThresh)
+                        {
+                            valid = false;
+                        }
+                    }
+                }
+                if(valid && Matching::checkPotSet(Matching::PotMatchSet{potMatches[i], potMatches[j], potMatches[k]},
+                                                  mapObjs,
+                                                  frameObjs,
+                                                  angThresh,
+                                                  angThresh,
+                                                  angThresh))
+                {
+                    refPotSets.push_back(curIdxs);
+                }
+            }
+        }
+    }
+    REQUIRE_FALSE(refPotSets.empty());
+    
+    ThreadPool threadPool(2);
+    
+    auto compPotSets = [&](const MapIndex *mapIndex){
+        vector<Matching::PotSetIdxs> potSets = Matching::findPotSets(potMatches,
+                                                                     mapObjs,
+                                                                     frameObjs,
+                                                                     planeDistThresh,
+                                                                     angThresh,
+                                                                     angThresh,
+                                                                     angThresh,
+                                                                     threadPool,
+                                                                     mapIndex);
+        vector<vector<int>> retPotSets;
+        for(const Matching::PotSetIdxs &potSet : potSets){
+            retPotSets.emplace_back(potSet.begin(), potSet.end());
+        }
+        sort(retPotSets.begin(), retPotSets.end());
+        return retPotSets;
+    };
+    
+    SECTION("without map index"){
+        REQUIRE(compPotSets(nullptr) == refPotSets);
+    }
+    
+    SECTION("with map index"){
+        MapIndex mapIndex(mapObjs, planeDistThresh, 0.1, 0.5, threadPool);
+        REQUIRE(compPotSets(&mapIndex) == refPotSets);
+    }
+}
+
+TEST_CASE("map index finds the same pairs and candidates as a linear scan", "[index]"){
+    static constexpr double maxDist = 5.0;
+    
+    vectorObjInstance objs = makeRoomObjs(0, Eigen::Vector3d::Zero());
+    ThreadPool threadPool(2);
+    MapIndex mapIndex(objs, maxDist, 0.1, 0.5, threadPool);
+    REQUIRE(mapIndex.isValidFor(objs));
+    REQUIRE(mapIndex.hasDescriptors());
+    
+    SECTION("pairs"){
+        for(double ang : {0.0, M_PI / 4, M_PI / 2, 2 * M_PI / 3, 3 * M_PI / 4}){
+            for(double distThresh : {0.5, maxDist}){
+                static constexpr double angThresh = 0.05;
+                
+                vector<pair<int, int>> pairs;
+                mapIndex.findPairs(ang, angThresh, distThresh, pairs);
+                sort(pairs.begin(), pairs.end());
+                REQUIRE(mapIndex.countPairs(ang, angThresh) >= pairs.size());
+                
+                vector<pair<int, int>> refPairs;
+                for(int o1 = 0; o1 < objs.size(); ++o1){
+                    for(int o2 = o1 + 1; o2 < objs.size(); ++o2){
+                        double dist = objs[o1].getHull().minDistance(objs[o2].getHull());
+                        double curAng = MapIndex::compNormalAngle(objs[o1], objs[o2]);
+                        if(fabs(curAng - ang) <= angThresh && dist <= distThresh){
+                            refPairs.emplace_back(o1, o2);
+                        }
+                    }
+                }
+                REQUIRE(pairs == refPairs);
+            }
+        }
+    }
+    
+    SECTION("candidates"){
+        ObjInstance::DescriptorThresh thresh;
+        thresh.maxAreaRatio = 2.0;
+        thresh.maxExtRatio = 2.0;
+        thresh.maxCurvDiff = 0.05;
+        thresh.maxHistDist = 2.5;
+        
+        for(const ObjInstance &frameObj : objs){
+            ObjInstance::Descriptor frameDesc = frameObj.compDescriptor();
+            vector<int> candidates;
+            mapIndex.findCandidates(frameDesc, thresh, candidates);
+            
+            vector<int> refCandidates;
+            for(int om = 0; om < objs.size(); ++om){
+                if(ObjInstance::checkDescriptors(frameDesc, objs[om].compDescriptor(), thresh)){
+                    refCandidates.push_back(om);
+                }
+            }
+            REQUIRE(candidates == refCandidates);
+        }
+    }
+}
+
+TEST_CASE("object grid returns near objects with similar normals", "[map]"){
+    ObjGrid grid(1.0, 0.1, 0.9);
+    
+    Eigen::Vector3d xAxis(1.0, 0.0, 0.0);
+    Eigen::Vector3d yAxis(0.0, 1.0, 0.0);
+    Eigen::Vector3d zAxis(0.0, 0.0, 1.0);
+    ObjInstance objQuery = makeRectObj(1, Eigen::Vector3d(0.0, 0.0, 1.0), xAxis, yAxis);
+    vectorObjInstance objs;
+    objs.push_back(objQuery);
+    // overlapping and parallel
+    objs.push_back(makeRectObj(2, Eigen::Vector3d(0.5, 0.5, 1.05), xAxis, yAxis));
+    // far away
+    objs.push_back(makeRectObj(3, Eigen::Vector3d(5.0, 5.0, 1.0), xAxis, yAxis));
+    // overlapping, but perpendicular
+    objs.push_back(makeRectObj(4, Eigen::Vector3d(0.5, 0.0, 0.5), yAxis, zAxis));
+    // separated by less than the margin
+    objs.push_back(makeRectObj(5, Eigen::Vector3d(1.05, 0.0, 1.0), xAxis, yAxis));
+    // separated by more than the margin
+    objs.push_back(makeRectObj(6, Eigen::Vector3d(1.3, 0.0, 1.0), xAxis, yAxis));
+    for(const ObjInstance &obj : objs){
+        grid.insert(obj);
+    }
+    REQUIRE(grid.size() == objs.size());
+    
+    REQUIRE((grid.getCandidates(objQuery) == vector<int>{1, 2, 5}));
+    
+    // objects that are not in the grid can be queried too
+    ObjInstance objFar = makeRectObj(7, Eigen::Vector3d(5.2, 5.2, 1.0), xAxis, yAxis);
+    REQUIRE((grid.getCandidates(objFar) == vector<int>{3}));
+    
+    grid.remove(2);
+    REQUIRE(grid.size() == objs.size() - 1);
+    REQUIRE((grid.getCandidates(objQuery) == vector<int>{1, 5}));
+}
+
+TEST_CASE("z-buffer counts pixels near the nearest surface", "[map]"){
+    cv::Mat cameraMatrix = (cv::Mat_<float>(3, 3) << 100.0, 0.0, 50.0,
+                                                     0.0, 100.0, 50.0,
+                                                     0.0, 0.0, 1.0);
+    ZBuffer zBuffer;
+    zBuffer.reset(100, 100, cameraMatrix);
+    
+    // pixel centers are at integer coordinates
+    auto square = [](double beg, double end){
+        return vector<vectorVector2d>{{{beg, beg}, {end, beg}, {end, end}, {beg, end}}};
+    };
+    // planes z = depth
+    auto plane = [](double depth){
+        return Eigen::Vector4d(0.0, 0.0, 1.0, -depth);
+    };
+    // 100 x 100 pixels
+    zBuffer.addObj(0, square(-0.5, 99.5), plane(4.0));
+    // 40 x 40 pixels
+    zBuffer.addObj(1, square(19.5, 59.5), plane(2.0));
+    // 40 x 40 pixels, 20 x 20 of them behind object 1, but within the tolerance
+    zBuffer.addObj(2, square(39.5, 79.5), plane(2.1));
+    // hidden
+    zBuffer.addObj(3, square(-0.5, 99.5), plane(6.0));
+    
+    REQUIRE(zBuffer.getDepth(0, 0) == Approx(4.0));
+    REQUIRE(zBuffer.getDepth(30, 30) == Approx(2.0));
+    REQUIRE(zBuffer.getDepth(70, 70) == Approx(2.1));
+    
+    map<int, int> idToCnt;
+    zBuffer.countVisible(0.2, 10.0, idToCnt);
+    REQUIRE(idToCnt[0] == 100 * 100 - (2 * 40 * 40 - 20 * 20));
+    REQUIRE(idToCnt[1] == 40 * 40);
+    REQUIRE(idToCnt[2] == 40 * 40);
+    REQUIRE(idToCnt[3] == 0);
+    
+    idToCnt.clear();
+    zBuffer.countVisible(0.2, 3.0, idToCnt);
+    REQUIRE(idToCnt[0] == 0);
+    REQUIRE(idToCnt[1] == 40 * 40);
+    REQUIRE(idToCnt[2] == 40 * 40);
+    
+    // buffers are cleared when reused
+    zBuffer.reset(100, 100, cameraMatrix);
+    idToCnt.clear();
+    zBuffer.countVisible(0.2, 10.0, idToCnt);
+    REQUIRE(idToCnt.empty());
+}
+
+TEST_CASE("vote accumulator returns cells with the largest sums", "[aggregation]"){
+    auto pose = [](double x, double y, double z){
+        Vector7d ret;
+        ret << x, y, z, 0.0, 0.0, 0.0, 1.0;
+        return ret;
+    };
+    
+    SECTION("peaks"){
+        VoteAccum voteAccum(0.1, 0.05);
+        voteAccum.addVote(pose(0.05, 0.05, 0.05), 1.0, 0);
+        voteAccum.addVote(pose(0.06, 0.04, 0.05), 2.0, 1);
+        voteAccum.addVote(pose(0.05, 0.05, 0.06), 0.5, 2);
+        voteAccum.addVote(pose(1.05, 0.05, 0.05), 1.5, 3);
+        voteAccum.addVote(pose(1.05, 0.05, 0.05), 1.0, 4);
+        voteAccum.addVote(pose(-2.05, 0.05, 0.05), 0.7, 5);
+        REQUIRE(voteAccum.size() == 3);
+        REQUIRE(voteAccum.eval(pose(0.01, 0.01, 0.01)) == Approx(3.5));
+        REQUIRE(voteAccum.eval(pose(0.5, 0.5, 0.5)) == 0.0);
+        
+        vector<pair<double, int>> peaks = voteAccum.getPeaks(2, false);
+        REQUIRE(peaks.size() == 2);
+        // represented by the votes with the largest weights
+        REQUIRE(peaks[0].first == Approx(3.5));
+        REQUIRE(peaks[0].second == 1);
+        REQUIRE(peaks[1].first == Approx(2.5));
+        REQUIRE(peaks[1].second == 3);
+        
+        REQUIRE(voteAccum.getPeaks(10, false).size() == 3);
+    }
+    
+    SECTION("refinement"){
+        VoteAccum voteAccum(0.1, 0.05);
+        // a peak split by the border of cells
+        voteAccum.addVote(pose(0.49, 0.55, 0.55), 1.0, 0);
+        voteAccum.addVote(pose(0.51, 0.55, 0.55), 1.0, 1);
+        voteAccum.addVote(pose(2.05, 0.05, 0.05), 1.5, 2);
+        
+        vector<pair<double, int>> peaks = voteAccum.getPeaks(3, false);
+        REQUIRE(peaks.front().first == Approx(1.5));
+        REQUIRE(peaks.front().second == 2);
+        
+        peaks = voteAccum.getPeaks(3, true);
+        REQUIRE(peaks.front().first == Approx(2.0));
+        REQUIRE(peaks.front().second != 2);
+        REQUIRE(peaks.back().first == Approx(1.5));
+    }
+}
+
+TEST_CASE("shards give the same hypotheses as a single map", "[matching]"){
+    Matching::Settings settings;
+    settings.planeAppThresh = 2.5;
+    settings.lineAppThresh = 1.0;
+    settings.lineToLineAngThresh = 0.26;
+    settings.planeToPlaneAngThresh = 0.26;
+    settings.planeToLineAngThresh = 0.26;
+    settings.planeDistThresh = 5.0;
+    settings.scoreThresh = 0.0;
+    settings.sinValsThresh = 0.03;
+    settings.planeEqDiffThresh = 0.02;
+    settings.intAreaThresh = 0.1;
+    settings.lineEqDiffThresh = 1.0;
+    settings.intLenThresh = 1.0;
+    settings.maxLineSubsetSize = 4;
+    settings.numThreads = 2;
+    settings.descThresh.maxHistDist = settings.planeAppThresh;
+    
+    // shards are farther apart than planeDistThresh, so no set mixes them
+    vectorObjInstance shard1 = makeRoomObjs(0, Eigen::Vector3d::Zero());
+    vectorObjInstance shard2 = makeRoomObjs(100, Eigen::Vector3d(30.0, 0.0, 0.0));
+    vectorObjInstance mapObjs = shard1;
+    mapObjs.insert(mapObjs.end(), shard2.begin(), shard2.end());
+    vectorObjInstance frameObjs = makeRoomObjs(200, Eigen::Vector3d::Zero());
+    
+    ThreadPool threadPool(settings.numThreads);
+    
+    // transformations with their sets of (map, frame) pairs, in a canonical order
+    auto compHypotheses = [](const Matching::MatchResult &result){
+        vector<pair<vector<pair<int, int>>, Vector7d>> hyps;
+        for(const Matching::ValidTransform &curTransform : result.transforms){
+            vector<pair<int, int>> matches;
+            for(const Matching::PotMatch &curMatch : curTransform.matchSet){
+                matches.emplace_back(curMatch.plane1, curMatch.plane2);
+            }
+            sort(matches.begin(), matches.end());
+            hyps.emplace_back(matches, curTransform.transform);
+        }
+        sort(hyps.begin(), hyps.end(),
+             [](const pair<vector<pair<int, int>>, Vector7d> &lhs,
+                const pair<vector<pair<int, int>>, Vector7d> &rhs){
+                 return lhs.first < rhs.first;
+             });
+        return hyps;
+    };
+    
+    Matching::Scratch scratchSingle;
+    Matching::Stats statsSingle;
+    Matching::MatchResult resultSingle;
+    Matching::matchFrameToMap(settings,
+                              threadPool,
+                              scratchSingle,
+                              statsSingle,
+                              frameObjs,
+                              mapObjs,
+                              nullptr,
+                              Matching::MatchOptions(),
+                              resultSingle);
+    
+    Matching::Scratch scratchShards;
+    Matching::Stats statsShards;
+    Matching::MatchResult resultShards;
+    Matching::matchFrameToShards(settings,
+                                 threadPool,
+                                 scratchShards,
+                                 statsShards,
+                                 frameObjs,
+                                 vector<Matching::MapShard>{Matching::MapShard(&shard1, nullptr),
+                                                            Matching::MapShard(&shard2, nullptr)},
+                                 Matching::MatchOptions(),
+                                 resultShards);
+    
+    auto hypsSingle = compHypotheses(resultSingle);
+    auto hypsShards = compHypotheses(resultShards);
+    REQUIRE_FALSE(hypsSingle.empty());
+    REQUIRE(hypsShards.size() == hypsSingle.size());
+    for(int h = 0; h < hypsSingle.size(); ++h){
+        REQUIRE(hypsShards[h].first == hypsSingle[h].first);
+        REQUIRE((hypsShards[h].second - hypsSingle[h].second).norm() < 1e-6);
+    }
+}